@@ -0,0 +1,70 @@
+#ifndef CAMERA_H
+#define CAMERA_H
+
+#include <cmath>
+
+#include "glm/glm.hpp"
+#include "glm/gtx/transform.hpp"
+#include "Core.h"
+
+/**
+ * @brief Pinhole camera generating the primary rays of an image.
+ */
+struct Camera {
+    // Position of the camera.
+    glm::vec3 origin = glm::vec3(0.0f);
+
+    // Rotation of the camera around the x axis and then around the y axis, in radians.
+    float xTiltAngle = 0.0f, yTiltAngle = 0.0f;
+
+    // Horizontal field of view in degrees.
+    float fov = 90.0f;
+
+    // z coordinate of the viewing direction before the rotation: 1 for the sampleScene, which looks
+    // towards +z, and -1 for the competitionScene.
+    float forward = 1.0f;
+
+    /**
+     * @brief Quantities shared by all the rays of an image of a given size.
+     */
+    struct View {
+        glm::vec3 origin;
+        glm::mat4 rotation;
+        float s, X, Y; // size of a pixel and position of the top left corner on the image plane
+        float forward;
+
+        /**
+         * @brief Generates the ray through pixel (i, j), offset from the centre of the pixel.
+         */
+        Ray ray(int i, int j, glm::vec2 offset) const {
+            float dx = X + (i + offset.x) * s + s / 2;
+            float dy = Y - (j + offset.y) * s - s / 2;
+            float dz = 1;
+
+            glm::vec4 direction4(dx, dy, forward * dz, 0.0f);
+            direction4 = rotation * direction4;
+
+            glm::vec3 direction = glm::normalize(glm::vec3(direction4));
+            return Ray(origin, direction);
+        }
+    };
+
+    /**
+     * @brief Precomputes the view of the camera for an image.
+     * @param width Width of the image.
+     * @param height Height of the image.
+     */
+    View view(int width, int height) const {
+        View view;
+        view.origin = origin;
+        view.rotation = glm::rotate(glm::mat4(1.0f), xTiltAngle, glm::vec3(1.0f, 0.0f, 0.0f));
+        view.rotation = glm::rotate(view.rotation, yTiltAngle, glm::vec3(0.0f, 1.0f, 0.0f));
+        view.s = 2 * tan(0.5 * fov / 180 * M_PI) / width;
+        view.X = -view.s * width / 2;
+        view.Y = view.s * height / 2;
+        view.forward = forward;
+        return view;
+    }
+};
+
+#endif // CAMERA_H
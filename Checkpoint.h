@@ -0,0 +1,231 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+/*
+ * FEAT: CHECKPOINT AND RESUME
+ * The finished tiles are appended to a checkpoint file as they complete:
+ * a header describing the render, then one record per tile holding the
+ * linear colors of its pixels and a checksum. The file is flushed every
+ * few seconds, so a killed render loses at most the tiles finished since the
+ * last flush. A record cut short by the kill fails its checksum and is
+ * dropped when the file is read back.
+ *
+ * When resuming, the records are indexed by tile and the tiles are read
+ * back from the file when the scheduler reaches them, so that resuming a
+ * streamed render does not need the whole image in memory either.
+ **/
+
+/**
+ * @brief Description of a render stored in the checkpoint, resuming requires the same values.
+ */
+struct CheckpointHeader {
+    int32_t width = 0, height = 0;
+    int32_t tileSize = 0;
+    int32_t minSamples = 0, maxSamples = 0;
+    int32_t pattern = 0;
+    int32_t cropX0 = 0, cropY0 = 0, cropX1 = 0, cropY1 = 0;
+    int32_t bounces = 0;
+    // camera after the command line overrides
+    glm::vec3 cameraOrigin = glm::vec3(0.0f);
+    float cameraXTilt = 0.0f, cameraYTilt = 0.0f, cameraFov = 0.0f, cameraForward = 0.0f;
+    uint64_t sceneHash = 0; ///< CompiledScene::hash of the scene description
+
+    bool operator==(const CheckpointHeader &other) const {
+        return std::memcmp(this, &other, sizeof(CheckpointHeader)) == 0;
+    }
+};
+
+static_assert(sizeof(CheckpointHeader) == 80, "the header is compared byte by byte, it must not have padding");
+
+/**
+ * @brief Class appending finished tiles to a checkpoint file and reading them back when resuming.
+ * All the methods can be called concurrently from several threads.
+ */
+class RenderCheckpoint {
+private:
+    static constexpr char magic[8] = {'R', 'T', 'C', 'K', 'P', 'T', '0', '2'};
+
+    /**
+     * @brief Position of a tile record in the file.
+     */
+    struct Record {
+        std::streamoff offset = -1; // position of the colors, -1 if the tile is not in the file
+        int64_t samples = 0;
+    };
+
+    std::string path;
+    CheckpointHeader header;
+    std::vector<int> tilePixels; // number of pixels of every tile
+    std::vector<Record> records;
+    int resumedTiles = 0;
+
+    std::ofstream output;
+    std::ifstream input;
+    std::mutex fileMutex;
+
+    double flushInterval;
+    std::chrono::steady_clock::time_point lastFlush;
+
+    static uint32_t fnv1a(const void *data, size_t size, uint32_t hash = 2166136261u) {
+        const uint8_t *bytes = static_cast<const uint8_t *>(data);
+        for (size_t i = 0; i < size; i++) {
+            hash = (hash ^ bytes[i]) * 16777619u;
+        }
+        return hash;
+    }
+
+    /**
+     * @brief Indexes the valid records of an existing checkpoint.
+     * @return Size of the valid part of the file, 0 if it cannot be resumed.
+     */
+    std::streamoff scan() {
+        std::ifstream file(path, std::ios::binary);
+        char fileMagic[sizeof(magic)];
+        CheckpointHeader fileHeader;
+        if (!file.read(fileMagic, sizeof(fileMagic)) ||
+            !file.read(reinterpret_cast<char *>(&fileHeader), sizeof(fileHeader))) {
+            return 0;
+        }
+        if (std::memcmp(fileMagic, magic, sizeof(magic)) != 0 || !(fileHeader == header)) {
+            printf("The checkpoint %s was written for different render settings, starting over\n", path.c_str());
+            return 0;
+        }
+
+        std::streamoff valid = file.tellg();
+        std::vector<glm::vec3> colors;
+        while (true) {
+            int32_t index;
+            int64_t samples;
+            uint32_t checksum;
+            if (!file.read(reinterpret_cast<char *>(&index), sizeof(index)) || index < 0 ||
+                index >= (int) records.size()) {
+                break;
+            }
+            colors.resize(tilePixels[index]);
+            if (!file.read(reinterpret_cast<char *>(&samples), sizeof(samples)) ||
+                !file.read(reinterpret_cast<char *>(colors.data()), colors.size() * sizeof(glm::vec3)) ||
+                !file.read(reinterpret_cast<char *>(&checksum), sizeof(checksum))) {
+                break;
+            }
+            uint32_t hash = fnv1a(&index, sizeof(index));
+            hash = fnv1a(&samples, sizeof(samples), hash);
+            hash = fnv1a(colors.data(), colors.size() * sizeof(glm::vec3), hash);
+            if (hash != checksum) {
+                break;
+            }
+            if (records[index].offset < 0) {
+                resumedTiles++;
+            }
+            records[index].offset = valid + (std::streamoff) (sizeof(index) + sizeof(samples));
+            records[index].samples = samples;
+            valid = file.tellg();
+        }
+        return valid;
+    }
+
+public:
+    /**
+     * @brief Constructor for the checkpoint, opening the file for appending the tiles.
+     * @param path Path of the checkpoint file.
+     * @param header Description of the render.
+     * @param tilePixels Number of pixels of every tile, by tile index.
+     * @param resume If true, the tiles of an existing checkpoint of the same render are kept.
+     * @param flushInterval Seconds between two flushes of the file.
+     */
+    RenderCheckpoint(std::string path, const CheckpointHeader &header, std::vector<int> tilePixels, bool resume,
+                     double flushInterval)
+            : path(std::move(path)), header(header), tilePixels(std::move(tilePixels)),
+              records(this->tilePixels.size()), flushInterval(flushInterval) {
+        std::error_code error;
+        std::streamoff valid = resume && std::filesystem::exists(this->path, error) ? scan() : 0;
+        if (valid > 0) {
+            // drop a record cut short by the end of the previous run
+            std::filesystem::resize_file(this->path, valid, error);
+            output.open(this->path, std::ios::binary | std::ios::app);
+            input.open(this->path, std::ios::binary);
+        } else {
+            output.open(this->path, std::ios::binary | std::ios::trunc);
+            output.write(magic, sizeof(magic));
+            output.write(reinterpret_cast<const char *>(&header), sizeof(header));
+            output.flush();
+        }
+        lastFlush = std::chrono::steady_clock::now();
+    }
+
+    bool isOpen() const { return output.is_open(); }
+
+    /**
+     * @brief Gets the number of tiles found in the checkpoint when resuming.
+     */
+    int getResumedTiles() const { return resumedTiles; }
+
+    /**
+     * @brief True if the tile was finished by a previous run.
+     */
+    bool isCompleted(int tileIndex) const { return records[tileIndex].offset >= 0; }
+
+    /**
+     * @brief Reads back a tile finished by a previous run.
+     * @param tileIndex Index of the tile.
+     * @param colors Linear colors of the pixels of the tile, row by row.
+     * @return Number of samples that were traced for the tile.
+     */
+    long readTile(int tileIndex, std::vector<glm::vec3> &colors) {
+        std::lock_guard<std::mutex> lock(fileMutex);
+        colors.resize(tilePixels[tileIndex]);
+        input.seekg(records[tileIndex].offset);
+        input.read(reinterpret_cast<char *>(colors.data()), colors.size() * sizeof(glm::vec3));
+        return (long) records[tileIndex].samples;
+    }
+
+    /**
+     * @brief Appends a finished tile, the file is flushed if the last flush is older than the interval.
+     * @param tileIndex Index of the tile.
+     * @param colors Linear colors of the pixels of the tile, row by row.
+     * @param samples Number of samples traced for the tile.
+     */
+    void writeTile(int tileIndex, const glm::vec3 *colors, long samples) {
+        const int32_t index = tileIndex;
+        const int64_t tileSamples = samples;
+        const size_t bytes = tilePixels[tileIndex] * sizeof(glm::vec3);
+        uint32_t checksum = fnv1a(&index, sizeof(index));
+        checksum = fnv1a(&tileSamples, sizeof(tileSamples), checksum);
+        checksum = fnv1a(colors, bytes, checksum);
+
+        std::lock_guard<std::mutex> lock(fileMutex);
+        output.write(reinterpret_cast<const char *>(&index), sizeof(index));
+        output.write(reinterpret_cast<const char *>(&tileSamples), sizeof(tileSamples));
+        output.write(reinterpret_cast<const char *>(colors), bytes);
+        output.write(reinterpret_cast<const char *>(&checksum), sizeof(checksum));
+        const auto now = std::chrono::steady_clock::now();
+        if (std::chrono::duration<double>(now - lastFlush).count() >= flushInterval) {
+            output.flush();
+            lastFlush = now;
+        }
+    }
+
+    /**
+     * @brief Removes the checkpoint once the image has been written.
+     */
+    void remove() {
+        std::lock_guard<std::mutex> lock(fileMutex);
+        output.close();
+        input.close();
+        std::error_code error;
+        std::filesystem::remove(path, error);
+    }
+};
+
+#endif // CHECKPOINT_H
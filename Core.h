@@ -3,6 +3,9 @@
 #ifndef CORE_H
 #define CORE_H
 
+#include <cmath>
+#include <cstdint>
+
 #include "glm/geometric.hpp"
 #include "glm/glm.hpp"
 
@@ -47,6 +50,9 @@ struct Hit {
   // A pointer to the intersected object.
   Object *object;
 
+  // Index of the material of the intersected object in the material table.
+  uint16_t material;
+
   // Coordinates for computing the texture (texture coordinates).
   glm::vec2 uv;
 
@@ -56,6 +62,29 @@ struct Hit {
   glm::vec3 bitangent;
 };
 
+/**
+ * @brief Structure representing the closest intersection found while traversing
+ * the scene. It only holds what is needed to compare the intersections, the
+ * surface at the intersection point (Hit) is computed once, for the closest one.
+ */
+struct HitRecord {
+  // Distance from the origin of the ray to the intersection point, INFINITY if
+  // there was no intersection.
+  float distance = INFINITY;
+
+  // A pointer to the intersected object, nullptr if there was no intersection.
+  Object *object = nullptr;
+
+  // Index of the intersected triangle in its mesh.
+  uint32_t primitive = 0;
+
+  // Parameter of the intersection along the ray in the coordinates where the
+  // object intersected it, local for the objects that have a transformation.
+  float t = 0;
+
+  bool hit() const { return object != nullptr; }
+};
+
 // add bvh box
 
 #endif // CORE_H
@@ -0,0 +1,610 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <omp.h>
+
+#include "glm/glm.hpp"
+#include "Checkpoint.h"
+#include "TileScheduler.h"
+
+/*
+ * FEAT: DISTRIBUTED RENDERING
+ * A coordinator process hands out batches of tiles over TCP to worker
+ * processes, which load the scene themselves, render the tiles with the
+ * usual tile loop and send back the linear colors of every tile. The
+ * coordinator only stores the results.
+ *
+ * Every message is a small header (type and payload size) followed by the
+ * payload, in the byte order of the machines, which are expected to share
+ * the same architecture. The workers start by sending the description of
+ * their render (the checkpoint header), so that a worker started with
+ * different settings is turned away instead of mixing two images.
+ *
+ * Tiles are never lost: the tiles of a worker that disconnects, or that
+ * sends nothing for tileTimeout seconds, go back to the queue. Once the
+ * queue is empty, idle workers also get a copy of the tiles still being
+ * rendered elsewhere, so a slow worker does not hold back the end of the
+ * frame; the first result of a tile wins.
+ **/
+
+/**
+ * @brief Types of the messages between the coordinator and the workers.
+ */
+enum class MessageType : uint32_t {
+    Hello = 1,  ///< worker -> coordinator: render description and number of threads
+    Tiles = 2,  ///< coordinator -> worker: indices of the tiles to render
+    Result = 3, ///< worker -> coordinator: tile index, samples and colors of a tile
+    Done = 4    ///< coordinator -> worker: no tiles left, the worker exits
+};
+
+/**
+ * @brief Header preceding every message.
+ */
+struct MessageHeader {
+    uint32_t type;
+    uint32_t size; // size of the payload in bytes
+};
+
+/**
+ * @brief Function receiving a rendered tile with the linear colors of its pixels row by row and
+ * the number of samples traced for it.
+ */
+using TileResultFunction = std::function<void(const Tile &, const glm::vec3 *, long)>;
+
+inline void appendBytes(std::vector<uint8_t> &bytes, const void *data, size_t size) {
+    const uint8_t *begin = static_cast<const uint8_t *>(data);
+    bytes.insert(bytes.end(), begin, begin + size);
+}
+
+/**
+ * @brief Sends a whole message, without raising SIGPIPE if the other side is gone.
+ * @return False if the connection is broken.
+ */
+inline bool sendMessage(int socket, MessageType type, const std::vector<uint8_t> &payload) {
+    std::vector<uint8_t> bytes;
+    const MessageHeader header{(uint32_t) type, (uint32_t) payload.size()};
+    appendBytes(bytes, &header, sizeof(header));
+    bytes.insert(bytes.end(), payload.begin(), payload.end());
+
+    size_t sent = 0;
+    while (sent < bytes.size()) {
+        const ssize_t n = send(socket, bytes.data() + sent, bytes.size() - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // non-blocking socket with a full buffer, wait until the worker reads
+            pollfd fd{socket, POLLOUT, 0};
+            poll(&fd, 1, 1000);
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        sent += n;
+    }
+    return true;
+}
+
+/**
+ * @brief Receives exactly size bytes from a blocking socket.
+ * @return False if the connection is closed before.
+ */
+inline bool receiveAll(int socket, void *data, size_t size) {
+    uint8_t *bytes = static_cast<uint8_t *>(data);
+    while (size > 0) {
+        const ssize_t n = recv(socket, bytes, size, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        bytes += n;
+        size -= n;
+    }
+    return true;
+}
+
+/**
+ * @brief Class handing out the tiles of a frame to worker processes and collecting the results.
+ */
+class TileCoordinator {
+private:
+    /**
+     * @brief State of a connected worker.
+     */
+    struct Worker {
+        int socket = -1;
+        std::string name;
+        std::vector<uint8_t> received; // bytes not yet forming a whole message
+        int threads = 0;
+        bool ready = false;            // the render description was checked
+        std::vector<int> assigned;     // tiles handed to the worker and not returned yet
+        std::chrono::steady_clock::time_point lastActivity;
+    };
+
+    CheckpointHeader header;
+    std::vector<Tile> tilesByIndex;
+    std::vector<bool> done;
+    std::vector<bool> duplicated; // the tile was also handed to a second worker
+    std::deque<int> pending;      // tiles waiting for a worker, in rendering order
+    int remaining = 0;
+    long totalSamples = 0;
+    double tileTimeout;
+
+    int listener = -1;
+    int port = 0;
+    std::vector<Worker> workers;
+    std::vector<pid_t> localWorkers;
+
+    /**
+     * @brief Puts the unfinished tiles of a worker back at the front of the queue.
+     */
+    void requeue(Worker &worker) {
+        for (auto tile = worker.assigned.rbegin(); tile != worker.assigned.rend(); ++tile) {
+            if (!done[*tile]) {
+                pending.push_front(*tile);
+            }
+        }
+        worker.assigned.clear();
+    }
+
+    void disconnect(Worker &worker, const char *reason) {
+        printf("\nWorker %s %s, %d tiles go back to the queue\n", worker.name.c_str(), reason,
+               (int) std::count_if(worker.assigned.begin(), worker.assigned.end(),
+                                   [&](int tile) { return !done[tile]; }));
+        requeue(worker);
+        close(worker.socket);
+        worker.socket = -1;
+    }
+
+    /**
+     * @brief Handles the complete messages received from a worker.
+     * @return False if the worker has to be disconnected.
+     */
+    bool handleMessages(Worker &worker, const TileResultFunction &store) {
+        size_t offset = 0;
+        while (worker.received.size() - offset >= sizeof(MessageHeader)) {
+            MessageHeader message;
+            std::memcpy(&message, worker.received.data() + offset, sizeof(message));
+            if (worker.received.size() - offset - sizeof(message) < message.size) {
+                break;
+            }
+            const uint8_t *payload = worker.received.data() + offset + sizeof(message);
+            offset += sizeof(message) + message.size;
+
+            if (message.type == (uint32_t) MessageType::Hello) {
+                CheckpointHeader workerHeader;
+                int32_t threads;
+                if (message.size != sizeof(workerHeader) + sizeof(threads)) {
+                    return false;
+                }
+                std::memcpy(&workerHeader, payload, sizeof(workerHeader));
+                std::memcpy(&threads, payload + sizeof(workerHeader), sizeof(threads));
+                if (!(workerHeader == header)) {
+                    printf("\nWorker %s renders with different settings, turned away\n", worker.name.c_str());
+                    sendMessage(worker.socket, MessageType::Done, {});
+                    close(worker.socket);
+                    worker.socket = -1;
+                    return true;
+                }
+                worker.threads = std::max(threads, 1);
+                worker.ready = true;
+                printf("\nWorker %s joined with %d threads\n", worker.name.c_str(), worker.threads);
+            } else if (message.type == (uint32_t) MessageType::Result && worker.ready) {
+                int32_t index;
+                int64_t samples;
+                if (message.size < sizeof(index) + sizeof(samples)) {
+                    return false;
+                }
+                std::memcpy(&index, payload, sizeof(index));
+                std::memcpy(&samples, payload + sizeof(index), sizeof(samples));
+                if (index < 0 || index >= (int) tilesByIndex.size()) {
+                    return false;
+                }
+                const Tile &tile = tilesByIndex[index];
+                const size_t pixels = (size_t) (tile.x1 - tile.x0) * (tile.y1 - tile.y0);
+                if (message.size != sizeof(index) + sizeof(samples) + pixels * sizeof(glm::vec3)) {
+                    return false;
+                }
+                worker.assigned.erase(std::remove(worker.assigned.begin(), worker.assigned.end(), index),
+                                      worker.assigned.end());
+                if (!done[index]) {
+                    std::vector<glm::vec3> colors(pixels);
+                    std::memcpy(colors.data(), payload + sizeof(index) + sizeof(samples),
+                                pixels * sizeof(glm::vec3));
+                    done[index] = true;
+                    remaining--;
+                    totalSamples += samples;
+                    store(tile, colors.data(), samples);
+                }
+            } else {
+                return false;
+            }
+        }
+        worker.received.erase(worker.received.begin(), worker.received.begin() + offset);
+        return true;
+    }
+
+    /**
+     * @brief Hands a batch of tiles to an idle worker, or copies of the tiles of other workers
+     * once the queue is empty.
+     */
+    void assign(Worker &worker) {
+        const size_t batchSize = 2 * worker.threads;
+        std::vector<int> batch;
+        while (!pending.empty() && batch.size() < batchSize) {
+            const int tile = pending.front();
+            pending.pop_front();
+            if (!done[tile] && std::find(batch.begin(), batch.end(), tile) == batch.end()) {
+                batch.push_back(tile);
+            }
+        }
+        if (batch.empty()) {
+            // back up the tiles that other workers are still rendering, oldest first
+            for (const Worker &other: workers) {
+                for (int tile: other.assigned) {
+                    if (batch.size() < batchSize && other.socket != worker.socket && !done[tile] &&
+                        !duplicated[tile]) {
+                        duplicated[tile] = true;
+                        batch.push_back(tile);
+                    }
+                }
+            }
+        }
+        if (batch.empty()) {
+            return;
+        }
+
+        std::vector<uint8_t> payload;
+        for (int tile: batch) {
+            const int32_t index = tile;
+            appendBytes(payload, &index, sizeof(index));
+        }
+        worker.assigned = batch;
+        worker.lastActivity = std::chrono::steady_clock::now();
+        if (!sendMessage(worker.socket, MessageType::Tiles, payload)) {
+            disconnect(worker, "disconnected");
+        }
+    }
+
+    /**
+     * @brief Reaps the local workers that exited.
+     * @return Number of local workers still running.
+     */
+    int reapLocalWorkers() {
+        int running = 0;
+        for (pid_t &pid: localWorkers) {
+            if (pid > 0) {
+                int status;
+                if (waitpid(pid, &status, WNOHANG) == pid) {
+                    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                        printf("\nLocal worker %d exited abnormally\n", pid);
+                    }
+                    pid = 0;
+                } else {
+                    running++;
+                }
+            }
+        }
+        return running;
+    }
+
+public:
+    /**
+     * @brief Constructor for the coordinator, listening for workers on a TCP port.
+     * @param port TCP port, 0 picks a free one.
+     * @param header Description of the render, the workers must send the same one.
+     * @param tiles Tiles to render, in the order they are handed out.
+     * @param tileTimeout Seconds without any result after which the tiles of a worker are handed to others.
+     */
+    TileCoordinator(int port, const CheckpointHeader &header, const std::vector<Tile> &tiles, double tileTimeout)
+            : header(header), tileTimeout(tileTimeout) {
+        int tileCount = 0;
+        for (const Tile &tile: tiles) {
+            tileCount = std::max(tileCount, tile.index + 1);
+        }
+        tilesByIndex.resize(tileCount);
+        done.assign(tileCount, false);
+        duplicated.assign(tileCount, false);
+        for (const Tile &tile: tiles) {
+            tilesByIndex[tile.index] = tile;
+            pending.push_back(tile.index);
+        }
+        remaining = (int) tiles.size();
+
+        listener = socket(AF_INET, SOCK_STREAM, 0);
+        const int yes = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_ANY);
+        address.sin_port = htons(port);
+        if (bind(listener, (sockaddr *) &address, sizeof(address)) != 0 || listen(listener, 64) != 0) {
+            close(listener);
+            listener = -1;
+            return;
+        }
+        socklen_t length = sizeof(address);
+        getsockname(listener, (sockaddr *) &address, &length);
+        this->port = ntohs(address.sin_port);
+    }
+
+    ~TileCoordinator() {
+        for (Worker &worker: workers) {
+            if (worker.socket >= 0) {
+                close(worker.socket);
+            }
+        }
+        if (listener >= 0) {
+            close(listener);
+        }
+        for (pid_t pid: localWorkers) {
+            if (pid > 0) {
+                waitpid(pid, nullptr, 0);
+            }
+        }
+    }
+
+    bool isListening() const { return listener >= 0; }
+
+    int getPort() const { return port; }
+
+    /**
+     * @brief Marks a tile as finished, for the tiles read back from a checkpoint.
+     */
+    void markDone(int tileIndex) {
+        if (!done[tileIndex]) {
+            done[tileIndex] = true;
+            remaining--;
+        }
+    }
+
+    /**
+     * @brief Starts worker processes on this machine, sharing its cores.
+     * @param count Number of workers.
+     * @param arguments Command line of the workers, the first one being the executable.
+     */
+    void spawnLocalWorkers(int count, const std::vector<std::string> &arguments) {
+        const int threads = std::max(1, omp_get_num_procs() / std::max(count, 1));
+        for (int w = 0; w < count; w++) {
+            const pid_t pid = fork();
+            if (pid == 0) {
+                std::vector<char *> argv;
+                for (const std::string &argument: arguments) {
+                    argv.push_back(const_cast<char *>(argument.c_str()));
+                }
+                argv.push_back(nullptr);
+                setenv("OMP_NUM_THREADS", std::to_string(threads).c_str(), 1);
+                execv("/proc/self/exe", argv.data());
+                perror("execv");
+                _exit(1);
+            }
+            if (pid > 0) {
+                localWorkers.push_back(pid);
+            }
+        }
+    }
+
+    /**
+     * @brief Hands out the tiles until all of them are rendered.
+     * @param store Function storing the first result of every tile.
+     * @return Number of samples traced by the workers, -1 if the render could not be finished.
+     */
+    long run(const TileResultFunction &store) {
+        const int total = remaining;
+        std::vector<uint8_t> buffer(1 << 16);
+        while (remaining > 0) {
+            std::vector<pollfd> fds{{listener, POLLIN, 0}};
+            for (const Worker &worker: workers) {
+                fds.push_back({worker.socket, POLLIN, 0});
+            }
+            poll(fds.data(), fds.size(), 250);
+
+            if (fds[0].revents & POLLIN) {
+                sockaddr_in address{};
+                socklen_t length = sizeof(address);
+                const int socket = accept(listener, (sockaddr *) &address, &length);
+                if (socket >= 0) {
+                    const int yes = 1;
+                    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+                    fcntl(socket, F_SETFL, fcntl(socket, F_GETFL) | O_NONBLOCK);
+                    Worker worker;
+                    worker.socket = socket;
+                    worker.name = std::string(inet_ntoa(address.sin_addr)) + ":" +
+                                  std::to_string(ntohs(address.sin_port));
+                    worker.lastActivity = std::chrono::steady_clock::now();
+                    workers.push_back(worker);
+                }
+            }
+
+            for (size_t w = 0; w + 1 < fds.size() && w < workers.size(); w++) {
+                Worker &worker = workers[w];
+                if (!(fds[w + 1].revents & (POLLIN | POLLHUP | POLLERR))) {
+                    continue;
+                }
+                bool closed = false;
+                while (true) {
+                    const ssize_t n = recv(worker.socket, buffer.data(), buffer.size(), 0);
+                    if (n > 0) {
+                        worker.received.insert(worker.received.end(), buffer.begin(), buffer.begin() + n);
+                        worker.lastActivity = std::chrono::steady_clock::now();
+                    } else if (n < 0 && errno == EINTR) {
+                        continue;
+                    } else {
+                        closed = n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+                        break;
+                    }
+                }
+                if (!handleMessages(worker, store)) {
+                    disconnect(worker, "sent an invalid message");
+                } else if (closed && worker.socket >= 0) {
+                    disconnect(worker, "disconnected");
+                }
+            }
+
+            const auto now = std::chrono::steady_clock::now();
+            for (Worker &worker: workers) {
+                if (worker.socket >= 0 && !worker.assigned.empty() &&
+                    std::chrono::duration<double>(now - worker.lastActivity).count() > tileTimeout) {
+                    disconnect(worker, "timed out");
+                }
+            }
+            workers.erase(std::remove_if(workers.begin(), workers.end(),
+                                         [](const Worker &worker) { return worker.socket < 0; }), workers.end());
+
+            for (Worker &worker: workers) {
+                if (worker.ready && worker.assigned.empty() && remaining > 0) {
+                    assign(worker);
+                }
+            }
+            workers.erase(std::remove_if(workers.begin(), workers.end(),
+                                         [](const Worker &worker) { return worker.socket < 0; }), workers.end());
+
+            if (reapLocalWorkers() == 0 && !localWorkers.empty() && workers.empty()) {
+                printf("\nAll the local workers exited before the end of the render\n");
+                return -1;
+            }
+            printf("Progress: %.2f%% (%d workers)\r", 100.0 * (total - remaining) / std::max(total, 1),
+                   (int) workers.size());
+            fflush(stdout);
+        }
+
+        for (Worker &worker: workers) {
+            sendMessage(worker.socket, MessageType::Done, {});
+        }
+        return totalSamples;
+    }
+};
+
+/**
+ * @brief Renders tiles for a coordinator until it has no tiles left.
+ * @param address Address of the coordinator, as host:port.
+ * @param header Description of the render, checked by the coordinator.
+ * @param tiles Tiles of the frame, the coordinator sends their indices.
+ * @param render Function rendering a batch of tiles, calling its result function for every tile.
+ * @return True if the coordinator finished the frame.
+ */
+inline bool runTileWorker(const std::string &address, const CheckpointHeader &header, const std::vector<Tile> &tiles,
+                          const std::function<void(const std::vector<Tile> &, const TileResultFunction &)> &render) {
+    const size_t colon = address.rfind(':');
+    if (colon == std::string::npos) {
+        printf("The coordinator address must be host:port\n");
+        return false;
+    }
+    const std::string host = address.substr(0, colon);
+    const std::string port = address.substr(colon + 1);
+
+    addrinfo hints{};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *result = nullptr;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &result) != 0) {
+        printf("Unknown coordinator host %s\n", host.c_str());
+        return false;
+    }
+    int socket = -1;
+    // the coordinator may still be starting
+    for (int attempt = 0; attempt < 20 && socket < 0; attempt++) {
+        socket = ::socket(AF_INET, SOCK_STREAM, 0);
+        if (connect(socket, result->ai_addr, result->ai_addrlen) != 0) {
+            close(socket);
+            socket = -1;
+            std::this_thread::sleep_for(std::chrono::milliseconds(500));
+        }
+    }
+    freeaddrinfo(result);
+    if (socket < 0) {
+        printf("Could not connect to the coordinator %s\n", address.c_str());
+        return false;
+    }
+    const int yes = 1;
+    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+
+    std::vector<Tile> tilesByIndex;
+    for (const Tile &tile: tiles) {
+        if (tile.index >= (int) tilesByIndex.size()) {
+            tilesByIndex.resize(tile.index + 1, Tile{-1, 0, 0, 0, 0});
+        }
+        tilesByIndex[tile.index] = tile;
+    }
+
+    std::vector<uint8_t> hello;
+    const int32_t threads = omp_get_max_threads();
+    appendBytes(hello, &header, sizeof(header));
+    appendBytes(hello, &threads, sizeof(threads));
+    bool connected = sendMessage(socket, MessageType::Hello, hello);
+
+    std::mutex sendMutex; // results are sent from the rendering threads
+    while (true) {
+        // keep reading after a failed send, the coordinator may have sent Done before closing
+        MessageHeader message;
+        std::vector<uint8_t> payload;
+        if (!receiveAll(socket, &message, sizeof(message))) {
+            break;
+        }
+        payload.resize(message.size);
+        if (!receiveAll(socket, payload.data(), payload.size())) {
+            break;
+        }
+        if (message.type == (uint32_t) MessageType::Done) {
+            close(socket);
+            return true;
+        }
+        if (message.type != (uint32_t) MessageType::Tiles) {
+            break;
+        }
+
+        std::vector<Tile> batch;
+        for (size_t offset = 0; offset + sizeof(int32_t) <= payload.size(); offset += sizeof(int32_t)) {
+            int32_t index;
+            std::memcpy(&index, payload.data() + offset, sizeof(index));
+            if (index >= 0 && index < (int) tilesByIndex.size() && tilesByIndex[index].index == index) {
+                batch.push_back(tilesByIndex[index]);
+            }
+        }
+        render(batch, [&](const Tile &tile, const glm::vec3 *colors, long samples) {
+            std::vector<uint8_t> result;
+            const int32_t index = tile.index;
+            const int64_t tileSamples = samples;
+            appendBytes(result, &index, sizeof(index));
+            appendBytes(result, &tileSamples, sizeof(tileSamples));
+            appendBytes(result, colors, (size_t) (tile.x1 - tile.x0) * (tile.y1 - tile.y0) * sizeof(glm::vec3));
+            std::lock_guard<std::mutex> lock(sendMutex);
+            if (connected && !sendMessage(socket, MessageType::Result, result)) {
+                connected = false;
+            }
+        });
+    }
+    printf("Lost the connection to the coordinator\n");
+    close(socket);
+    return false;
+}
+
+#endif // DISTRIBUTED_H
@@ -0,0 +1,173 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <new>
+
+#include "glm/glm.hpp"
+#include "glm/gtc/packing.hpp"
+
+/*
+ * FEAT: COMPACT FRAMEBUFFER
+ * Pixel storage with a selectable pixel format:
+ * - RGB8 (3 bytes) for the final 8 bits output,
+ * - RGBA16F (8 bytes) for colors where half precision is enough, but not for
+ *   running sums, which lose precision as they grow,
+ * - RGB32F (12 bytes) for floating point outputs.
+ *
+ * The buffer is allocated on a cache line boundary and can be stored tile by
+ * tile instead of row by row. In the tile-major layout every tile is a
+ * contiguous block, so the threads rendering neighbouring tiles never write
+ * to the same cache line.
+ **/
+
+/**
+ * @brief 8 bits per channel color.
+ */
+struct RGB8 {
+    uint8_t r = 0, g = 0, b = 0;
+
+    void set(glm::vec3 color) {
+        // same truncation as the original Image::setPixel
+        color = glm::clamp(color, glm::vec3(0.0f), glm::vec3(1.0f));
+        r = (uint8_t) (int) (255 * color.r);
+        g = (uint8_t) (int) (255 * color.g);
+        b = (uint8_t) (int) (255 * color.b);
+    }
+
+    glm::vec3 get() const { return glm::vec3(r, g, b) / 255.0f; }
+};
+
+/**
+ * @brief Half precision floating point color with alpha.
+ */
+struct RGBA16F {
+    uint16_t r = 0, g = 0, b = 0, a = 0;
+
+    void set(glm::vec3 color) {
+        r = glm::packHalf1x16(color.r);
+        g = glm::packHalf1x16(color.g);
+        b = glm::packHalf1x16(color.b);
+        a = glm::packHalf1x16(1.0f);
+    }
+
+    glm::vec3 get() const {
+        return {glm::unpackHalf1x16(r), glm::unpackHalf1x16(g), glm::unpackHalf1x16(b)};
+    }
+};
+
+/**
+ * @brief Single precision floating point color.
+ */
+struct RGB32F {
+    float r = 0.0f, g = 0.0f, b = 0.0f;
+
+    void set(glm::vec3 color) {
+        r = color.r;
+        g = color.g;
+        b = color.b;
+    }
+
+    glm::vec3 get() const { return {r, g, b}; }
+};
+
+/**
+ * @brief Memory layouts of a framebuffer.
+ */
+enum class FramebufferLayout {
+    RowMajor, ///< One row after the other
+    TileMajor ///< One tile after the other, every tile stored row by row
+};
+
+/**
+ * @brief Class storing the pixels of an image in a given pixel format.
+ * @tparam Pixel Pixel format (RGB8, RGBA16F or RGB32F), or a plain value such as a sample count.
+ */
+template<typename Pixel>
+class Framebuffer {
+private:
+    struct AlignedDeleter {
+        void operator()(Pixel *pixels) const { std::free(pixels); }
+    };
+
+    // Alignment of the buffer, the size of a cache line.
+    static const size_t alignment = 64;
+
+    int width = 0, height = 0;
+    FramebufferLayout layout = FramebufferLayout::RowMajor;
+    int tileSize = 1;
+    int tilesX = 1;
+    size_t pixelCount = 0;
+    std::unique_ptr<Pixel[], AlignedDeleter> pixels;
+
+    size_t index(int x, int y) const {
+        if (layout == FramebufferLayout::RowMajor) {
+            return (size_t) y * width + x;
+        }
+        const int tile = (y / tileSize) * tilesX + x / tileSize;
+        return (size_t) tile * tileSize * tileSize + (y % tileSize) * tileSize + x % tileSize;
+    }
+
+public:
+    Framebuffer() = default;
+
+    /**
+     * @brief Constructor for the framebuffer, all pixels are initialized to zero.
+     * @param width Width of the image.
+     * @param height Height of the image.
+     * @param layout Memory layout of the pixels.
+     * @param tileSize Width and height of the tiles of the tile-major layout.
+     */
+    Framebuffer(int width, int height, FramebufferLayout layout = FramebufferLayout::RowMajor, int tileSize = 16)
+            : width(width), height(height), layout(layout), tileSize(tileSize) {
+        if (layout == FramebufferLayout::TileMajor) {
+            // the tiles on the right and bottom borders are padded to full tiles
+            tilesX = (width + tileSize - 1) / tileSize;
+            const int tilesY = (height + tileSize - 1) / tileSize;
+            pixelCount = (size_t) tilesX * tilesY * tileSize * tileSize;
+        } else {
+            pixelCount = (size_t) width * height;
+        }
+        const size_t bytes = (pixelCount * sizeof(Pixel) + alignment - 1) / alignment * alignment;
+        void *memory = std::aligned_alloc(alignment, std::max(bytes, alignment));
+        if (memory == nullptr) {
+            throw std::bad_alloc();
+        }
+        pixels.reset(static_cast<Pixel *>(memory));
+        std::uninitialized_fill_n(pixels.get(), pixelCount, Pixel());
+    }
+
+    int getWidth() const { return width; }
+
+    int getHeight() const { return height; }
+
+    /**
+     * @brief Gets the size of the pixel data in bytes.
+     */
+    size_t getBytes() const { return pixelCount * sizeof(Pixel); }
+
+    Pixel &at(int x, int y) { return pixels[index(x, y)]; }
+
+    const Pixel &at(int x, int y) const { return pixels[index(x, y)]; }
+
+    /**
+     * @brief Copies one row of the image into a contiguous array.
+     * @param y Index of the row.
+     * @param row Array of at least width pixels.
+     */
+    void readRow(int y, Pixel *row) const {
+        if (layout == FramebufferLayout::RowMajor) {
+            std::copy(&pixels[(size_t) y * width], &pixels[(size_t) y * width] + width, row);
+            return;
+        }
+        for (int x = 0; x < width; x += tileSize) {
+            const Pixel *tileRow = &pixels[index(x, y)];
+            std::copy(tileRow, tileRow + std::min(tileSize, width - x), row + x);
+        }
+    }
+};
+
+#endif // FRAMEBUFFER_H
@@ -0,0 +1,211 @@
+#ifndef GOLDEN_H
+#define GOLDEN_H
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/*
+ * FEAT: GOLDEN IMAGES
+ * End-to-end benchmark of the renderer: the sample and the competition
+ * scenes are rendered at a few fixed resolutions and sample counts, and
+ * every render is compared with a reference image stored in golden/. The
+ * wall time, the render time, the camera rays per second and the peak
+ * memory of every render are printed, and a render whose PSNR against its
+ * reference is below the threshold fails the run, so that an optimization
+ * can be shown to be faster without changing the picture.
+ *
+ * Every case is rendered by a new process running the same executable with
+ * --benchmark, which gives the peak memory of that render alone and a clean
+ * scene for every case.
+ **/
+
+/**
+ * @brief Render of the golden benchmark.
+ */
+struct GoldenCase {
+    const char *name; ///< Name of the reference image, without the extension
+    const char *scene;
+    int width, height, samples;
+};
+
+static const GoldenCase goldenCases[] = {
+        {"sample_128x96_1spp",       "./scenes/sample.scene",      128, 96,  1},
+        {"sample_256x192_4spp",      "./scenes/sample.scene",      256, 192, 4},
+        {"competition_96x72_4spp",   "./scenes/competition.scene", 96,  72,  4},
+        {"competition_128x96_1spp",  "./scenes/competition.scene", 128, 96,  1},
+};
+
+/**
+ * @brief Measurements of a render of the golden benchmark.
+ */
+struct GoldenMeasurement {
+    bool rendered = false;
+    double wallSeconds = 0;   ///< Whole process, loading the scene included
+    double renderSeconds = 0; ///< Median render time printed by --benchmark
+    double mrays = 0;         ///< Camera rays per second printed by --benchmark, in millions
+    long peakKilobytes = 0;   ///< Peak resident memory of the process
+};
+
+/**
+ * @brief Reads a binary 8 bits PPM (P6) image, as written by Image.
+ * @return False if the file is missing or is not such an image.
+ */
+inline bool readPPM(const std::string &path, int &width, int &height, std::vector<uint8_t> &pixels) {
+    std::ifstream file(path, std::ios::binary);
+    std::string magic;
+    int maxValue = 0;
+    if (!(file >> magic >> width >> height >> maxValue) || magic != "P6" || maxValue != 255 || width <= 0 ||
+        height <= 0) {
+        return false;
+    }
+    file.get(); // the single whitespace before the pixels
+    pixels.resize((size_t) width * height * 3);
+    return (bool) file.read(reinterpret_cast<char *>(pixels.data()), (std::streamsize) pixels.size());
+}
+
+/**
+ * @brief Peak signal-to-noise ratio of two images of the same size, in dB.
+ * @return Infinity if the images are identical.
+ */
+inline double imagePSNR(const std::vector<uint8_t> &a, const std::vector<uint8_t> &b) {
+    double squaredError = 0;
+    for (size_t i = 0; i < a.size(); i++) {
+        const double difference = (double) a[i] - (double) b[i];
+        squaredError += difference * difference;
+    }
+    if (squaredError == 0) {
+        return INFINITY;
+    }
+    return 10.0 * std::log10(255.0 * 255.0 * (double) a.size() / squaredError);
+}
+
+/**
+ * @brief Runs this executable with the given arguments and measures it.
+ * @param arguments Command line of the render, the first one being the executable, with --benchmark.
+ */
+inline GoldenMeasurement measureGoldenRender(const std::vector<std::string> &arguments) {
+    GoldenMeasurement measurement;
+    int output[2];
+    if (pipe(output) != 0) {
+        return measurement;
+    }
+    std::cout.flush();
+    fflush(stdout);
+    const auto start = std::chrono::steady_clock::now();
+    const pid_t pid = fork();
+    if (pid == 0) {
+        std::vector<char *> argv;
+        for (const std::string &argument: arguments) {
+            argv.push_back(const_cast<char *>(argument.c_str()));
+        }
+        argv.push_back(nullptr);
+        dup2(output[1], STDOUT_FILENO);
+        close(output[0]);
+        close(output[1]);
+        execv("/proc/self/exe", argv.data());
+        perror("execv");
+        _exit(1);
+    }
+    close(output[1]);
+    if (pid < 0) {
+        close(output[0]);
+        return measurement;
+    }
+
+    // the results of the render are read back from what it prints
+    std::string printed;
+    char buffer[4096];
+    ssize_t count;
+    while ((count = read(output[0], buffer, sizeof(buffer))) > 0) {
+        printed.append(buffer, (size_t) count);
+    }
+    close(output[0]);
+    int status = 0;
+    struct rusage usage{};
+    wait4(pid, &status, 0, &usage);
+    measurement.wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    measurement.peakKilobytes = usage.ru_maxrss;
+
+    const size_t line = printed.find("Median render time:");
+    measurement.rendered = WIFEXITED(status) && WEXITSTATUS(status) == 0 && line != std::string::npos &&
+                           sscanf(printed.c_str() + line, "Median render time: %lf seconds, %lf Mrays/s",
+                                  &measurement.renderSeconds, &measurement.mrays) == 2;
+    if (!measurement.rendered) {
+        std::cout << printed;
+    }
+    return measurement;
+}
+
+/**
+ * @brief Renders every case of the golden benchmark and compares it with its reference.
+ * @param directory Directory of the reference images.
+ * @param update If true, the renders replace the reference images instead of being compared with them.
+ * @param psnrThreshold Smallest PSNR in dB of a render against its reference.
+ * @param threads Threads of the renders, 0 for all the cores.
+ * @param runs Timed renders of every case, the median time is reported.
+ * @return False if a case could not be rendered or differs from its reference.
+ */
+inline bool runGoldenBenchmark(const std::string &directory, bool update, double psnrThreshold, int threads,
+                               int runs) {
+    bool passed = true;
+    if (update) {
+        mkdir(directory.c_str(), 0755);
+    }
+    printf("%-26s %9s %9s %9s %9s %9s\n", "case", "wall s", "render s", "Mrays/s", "peak MB", "PSNR dB");
+    for (const GoldenCase &golden: goldenCases) {
+        const std::string reference = directory + "/" + golden.name + ".ppm";
+        // the last render is kept next to the reference, to look at the differences when the comparison fails
+        const std::string render = update ? reference : directory + "/" + golden.name + ".last.ppm";
+        std::vector<std::string> arguments{"raytracer", "--scene", golden.scene,
+                                           "--width", std::to_string(golden.width),
+                                           "--height", std::to_string(golden.height),
+                                           "--samples", std::to_string(golden.samples),
+                                           "--benchmark", std::to_string(runs), "--output", render};
+        if (threads > 0) {
+            arguments.push_back("--threads");
+            arguments.push_back(std::to_string(threads));
+        }
+        const GoldenMeasurement measurement = measureGoldenRender(arguments);
+        if (!measurement.rendered) {
+            printf("%-26s could not be rendered\n", golden.name);
+            passed = false;
+            continue;
+        }
+        printf("%-26s %9.2f %9.2f %9.4f %9.1f ", golden.name, measurement.wallSeconds, measurement.renderSeconds,
+               measurement.mrays, measurement.peakKilobytes / 1024.0);
+        if (update) {
+            printf("%9s reference updated\n", "-");
+            continue;
+        }
+
+        int referenceWidth, referenceHeight, renderWidth, renderHeight;
+        std::vector<uint8_t> referencePixels, renderPixels;
+        if (!readPPM(reference, referenceWidth, referenceHeight, referencePixels)) {
+            printf("%9s no reference %s\n", "-", reference.c_str());
+            passed = false;
+        } else if (!readPPM(render, renderWidth, renderHeight, renderPixels) || renderWidth != referenceWidth ||
+                   renderHeight != referenceHeight) {
+            printf("%9s the render does not match the size of the reference\n", "-");
+            passed = false;
+        } else {
+            const double psnr = imagePSNR(referencePixels, renderPixels);
+            const bool similar = psnr >= psnrThreshold;
+            printf("%9.2f %s\n", psnr, similar ? "ok" : "FAILED");
+            passed = passed && similar;
+        }
+    }
+    return passed;
+}
+
+#endif // GOLDEN_H
@@ -0,0 +1,148 @@
+#ifndef HEATMAP_H
+#define HEATMAP_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "glm/glm.hpp"
+#include "Image.h"
+
+/*
+ * FEAT: COST HEATMAP
+ * The time spent tracing the samples of every pixel is measured with the
+ * cycle counter of the processor and written as a false-color image next to
+ * the render: result.ppm gets result.cycles.ppm. In builds with
+ * -DRAYTRACER_STATS, the BVH nodes and the triangles tested by the samples of
+ * every pixel are written as result.nodes.ppm and result.triangles.ppm too.
+ *
+ * The colors go from black through blue, green and yellow to red, the top of
+ * the scale being the 99th percentile of the pixels so that a few very
+ * expensive pixels do not hide the rest. With a .pfm or .exr output, the
+ * heatmaps hold the raw values instead, in all three channels.
+ *
+ * Only the samples traced by this run are measured: the tiles that --resume
+ * reads back from a checkpoint have no cost.
+ **/
+
+/**
+ * @brief Reads the cycle counter of the processor, or a nanosecond clock where there is none.
+ */
+inline uint64_t readCycleCounter() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+/**
+ * @brief Per-pixel costs of a region of the frame.
+ * A pixel is only traced by one thread at a time, so add can be called concurrently for different pixels.
+ */
+class CostHeatmap {
+private:
+    int x0, y0, width, height; ///< region of the frame covered by the heatmap
+    std::vector<uint64_t> cycles, nodes, triangles;
+
+    /**
+     * @brief Maps a value in [0, 1] to a color going from black to red through blue, green and yellow.
+     */
+    static glm::vec3 falseColor(float t) {
+        static const glm::vec3 stops[] = {glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 1.0f, 0.0f),
+                                          glm::vec3(1.0f, 1.0f, 0.0f), glm::vec3(1.0f, 0.0f, 0.0f)};
+        const float x = glm::clamp(t, 0.0f, 1.0f) * 4.0f;
+        const int stop = std::min((int) x, 3);
+        return glm::mix(stops[stop], stops[stop + 1], x - (float) stop);
+    }
+
+    /**
+     * @brief Inserts the name of a heatmap before the extension of the path of the render.
+     */
+    static std::string heatmapPath(const std::string &path, const char *name) {
+        const size_t dot = path.find_last_of('.');
+        const size_t slash = path.find_last_of('/');
+        if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+            return path + "." + name + ".ppm";
+        }
+        return path.substr(0, dot) + "." + name + path.substr(dot);
+    }
+
+    bool writeChannel(const std::vector<uint64_t> &values, const char *name, const std::string &renderPath,
+                      int imageWidth, int imageHeight, glm::ivec2 imageOrigin) const {
+        std::vector<uint64_t> sorted(values);
+        const size_t percentile = std::min(sorted.size() - 1, sorted.size() * 99 / 100);
+        std::nth_element(sorted.begin(), sorted.begin() + percentile, sorted.end());
+        const double top = std::max<double>((double) sorted[percentile], 1.0);
+
+        const std::string path = heatmapPath(renderPath, name);
+        const bool hdr = Image::isHDRPath(path.c_str());
+        Image image(imageWidth, imageHeight, hdr);
+        for (int y = 0; y < height; y++)
+            for (int x = 0; x < width; x++) {
+                const int i = x0 + x - imageOrigin.x;
+                const int j = y0 + y - imageOrigin.y;
+                const uint64_t value = values[y * width + x];
+                image.setPixel(i, j, falseColor((float) (value / top)));
+                image.setHDRPixel(i, j, glm::vec3((float) value));
+            }
+        if (!image.writeImage(path.c_str())) {
+            return false;
+        }
+        printf("Wrote the %s heatmap to %s, red is %.0f %s per pixel\n", name, path.c_str(), top, name);
+        return true;
+    }
+
+public:
+    /**
+     * @brief Constructor for the heatmap of a region, whose costs start at 0.
+     * @param x0 Left column of the region.
+     * @param y0 Top row of the region.
+     * @param x1 Column after the right of the region.
+     * @param y1 Row after the bottom of the region.
+     * @param counts If true, the BVH nodes and the triangles tested are kept as well.
+     */
+    CostHeatmap(int x0, int y0, int x1, int y1, bool counts)
+            : x0(x0), y0(y0), width(x1 - x0), height(y1 - y0), cycles((size_t) width * height),
+              nodes(counts ? (size_t) width * height : 0), triangles(counts ? (size_t) width * height : 0) {}
+
+    /**
+     * @brief Adds the cost of one sample of pixel (i, j) of the frame.
+     */
+    void add(int i, int j, uint64_t sampleCycles, uint64_t sampleNodes, uint64_t sampleTriangles) {
+        const size_t p = (size_t) (j - y0) * width + (i - x0);
+        cycles[p] += sampleCycles;
+        if (!nodes.empty()) {
+            nodes[p] += sampleNodes;
+            triangles[p] += sampleTriangles;
+        }
+    }
+
+    /**
+     * @brief Writes the heatmaps next to the render.
+     * @param renderPath Path of the render, the heatmaps get the same format.
+     * @param imageWidth Width of the render.
+     * @param imageHeight Height of the render.
+     * @param imageOrigin Position of the top left pixel of the render in the frame.
+     * @return False if a heatmap could not be written.
+     */
+    bool write(const std::string &renderPath, int imageWidth, int imageHeight, glm::ivec2 imageOrigin) const {
+        bool written = writeChannel(cycles, "cycles", renderPath, imageWidth, imageHeight, imageOrigin);
+        if (!nodes.empty()) {
+            written = writeChannel(nodes, "nodes", renderPath, imageWidth, imageHeight, imageOrigin) && written;
+            written = writeChannel(triangles, "triangles", renderPath, imageWidth, imageHeight, imageOrigin) &&
+                      written;
+        }
+        return written;
+    }
+};
+
+#endif // HEATMAP_H
@@ -13,8 +13,474 @@
 #ifndef Image_h
 #define Image_h
 
+#include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Framebuffer.h"
+#include "Profiler.h"
+
 using namespace std;
 
+/**
+ Compressor producing a raw deflate stream (RFC 1951) with fixed Huffman codes and LZ77 matches.
+ Data can be given in several chunks, every chunk becomes one deflate block.
+ */
+class DeflateEncoder {
+private:
+    vector<uint8_t> output; ///< compressed bytes not yet taken
+    uint32_t bitBuffer = 0; ///< bits not yet forming a whole byte
+    int bitCount = 0;       ///< number of bits in bitBuffer
+
+    void putBits(uint32_t value, int count) {
+        bitBuffer |= value << bitCount;
+        bitCount += count;
+        while (bitCount >= 8) {
+            output.push_back(bitBuffer & 0xff);
+            bitBuffer >>= 8;
+            bitCount -= 8;
+        }
+    }
+
+    // Huffman codes are stored starting from the most significant bit
+    void putCode(uint32_t code, int length) {
+        uint32_t reversed = 0;
+        for (int i = 0; i < length; i++) {
+            reversed = (reversed << 1) | ((code >> i) & 1);
+        }
+        putBits(reversed, length);
+    }
+
+    void putSymbol(int symbol) {
+        if (symbol < 144) {
+            putCode(0x30 + symbol, 8);
+        } else if (symbol < 256) {
+            putCode(0x190 + symbol - 144, 9);
+        } else if (symbol < 280) {
+            putCode(symbol - 256, 7);
+        } else {
+            putCode(0xc0 + symbol - 280, 8);
+        }
+    }
+
+    void putMatch(int length, int distance) {
+        static const int lengthBase[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59,
+                                           67, 83, 99, 115, 131, 163, 195, 227, 258};
+        static const int lengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4,
+                                            5, 5, 5, 5, 0};
+        static const int distanceBase[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385,
+                                             513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+        static const int distanceExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10,
+                                              10, 11, 11, 12, 12, 13, 13};
+        int l = 28;
+        while (lengthBase[l] > length) {
+            l--;
+        }
+        putSymbol(257 + l);
+        putBits(length - lengthBase[l], lengthExtra[l]);
+
+        int d = 29;
+        while (distanceBase[d] > distance) {
+            d--;
+        }
+        putCode(d, 5);
+        putBits(distance - distanceBase[d], distanceExtra[d]);
+    }
+
+public:
+    /**
+     Compresses a chunk of data into one deflate block
+     @param data data to compress
+     @param size size of the data in bytes
+     @param last true if this is the last block of the stream
+     */
+    void compress(const uint8_t *data, size_t size, bool last) {
+        const int windowSize = 32768;
+        const int maxLength = 258;
+        const int maxChain = 32;
+        const int hashBits = 15;
+
+        putBits(last ? 1 : 0, 1);
+        putBits(1, 2); // fixed Huffman codes
+
+        vector<int> head(1 << hashBits, -1);
+        vector<int> previous(size, -1);
+        auto hash = [&](size_t i) {
+            return ((data[i] << 10) ^ (data[i + 1] << 5) ^ data[i + 2]) & ((1 << hashBits) - 1);
+        };
+        auto insert = [&](size_t i) {
+            if (i + 2 < size) {
+                const int h = hash(i);
+                previous[i] = head[h];
+                head[h] = (int) i;
+            }
+        };
+
+        size_t i = 0;
+        while (i < size) {
+            int bestLength = 0;
+            int bestDistance = 0;
+            if (i + 2 < size) {
+                int candidate = head[hash(i)];
+                for (int chain = 0; chain < maxChain && candidate >= 0 && i - candidate <= windowSize; chain++) {
+                    int length = 0;
+                    const int limit = (int) min<size_t>(maxLength, size - i);
+                    while (length < limit && data[candidate + length] == data[i + length]) {
+                        length++;
+                    }
+                    if (length > bestLength) {
+                        bestLength = length;
+                        bestDistance = (int) (i - candidate);
+                        if (length == limit) {
+                            break;
+                        }
+                    }
+                    candidate = previous[candidate];
+                }
+            }
+            if (bestLength >= 3) {
+                putMatch(bestLength, bestDistance);
+                for (int k = 0; k < bestLength; k++) {
+                    insert(i + k);
+                }
+                i += bestLength;
+            } else {
+                putSymbol(data[i]);
+                insert(i);
+                i++;
+            }
+        }
+        putSymbol(256); // end of block
+
+        if (last) {
+            // pad the stream to a whole byte
+            putBits(0, (8 - bitCount) % 8);
+        }
+    }
+
+    /**
+     Takes the compressed bytes produced so far
+     */
+    vector<uint8_t> take() {
+        vector<uint8_t> bytes;
+        bytes.swap(output);
+        return bytes;
+    }
+};
+
+/**
+ Class writing an image to a file row by row, from the top row to the bottom one.
+ The format is chosen from the extension of the path:
+ - .png: 8 bits RGB PNG
+ - .pfm: 32 bits floating point Portable FloatMap
+ - .exr: 32 bits floating point uncompressed OpenEXR
+ - anything else: binary 8 bits PPM (P6)
+ */
+class ImageWriter {
+public:
+    enum Format {
+        PPM, PNG, PFM, EXR
+    };
+
+private:
+    ofstream file;
+    Format format;
+    int width, height;
+    int row = 0;               ///< index of the next row to be written
+    streamoff dataStart = 0;   ///< position of the pixel data in the file
+
+    // PNG state
+    DeflateEncoder deflate;
+    vector<uint8_t> previousRow; ///< previous row, needed by the PNG filters
+    vector<uint8_t> pending;     ///< filtered rows waiting to be compressed
+    uint32_t adler_a = 1, adler_b = 0; ///< Adler-32 checksum of the uncompressed data
+    bool zlibHeaderWritten = false;
+
+    static uint32_t crc32(const uint8_t *data, size_t size, uint32_t crc = 0xffffffffu) {
+        static const array<uint32_t, 256> table = [] {
+            array<uint32_t, 256> t{};
+            for (uint32_t n = 0; n < 256; n++) {
+                uint32_t c = n;
+                for (int k = 0; k < 8; k++) {
+                    c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+                }
+                t[n] = c;
+            }
+            return t;
+        }();
+        for (size_t i = 0; i < size; i++) {
+            crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+        }
+        return crc;
+    }
+
+    static void putBigEndian(vector<uint8_t> &bytes, uint32_t value) {
+        bytes.push_back(value >> 24);
+        bytes.push_back(value >> 16);
+        bytes.push_back(value >> 8);
+        bytes.push_back(value);
+    }
+
+    template<typename T>
+    void putLittleEndian(T value) {
+        // all supported platforms are little endian
+        file.write(reinterpret_cast<const char *>(&value), sizeof(T));
+    }
+
+    void writeChunk(const char *type, const vector<uint8_t> &data) {
+        vector<uint8_t> chunk(type, type + 4);
+        chunk.insert(chunk.end(), data.begin(), data.end());
+        vector<uint8_t> header;
+        putBigEndian(header, (uint32_t) data.size());
+        file.write(reinterpret_cast<const char *>(header.data()), header.size());
+        file.write(reinterpret_cast<const char *>(chunk.data()), chunk.size());
+        vector<uint8_t> crc;
+        putBigEndian(crc, crc32(chunk.data(), chunk.size()) ^ 0xffffffffu);
+        file.write(reinterpret_cast<const char *>(crc.data()), crc.size());
+    }
+
+    void writeAttribute(const char *name, const char *type, const void *value, int size) {
+        file.write(name, strlen(name) + 1);
+        file.write(type, strlen(type) + 1);
+        putLittleEndian<int32_t>(size);
+        file.write(reinterpret_cast<const char *>(value), size);
+    }
+
+    void writeHeader() {
+        switch (format) {
+            case PPM:
+                file << "P6\n" << width << " " << height << "\n255\n";
+                break;
+            case PFM:
+                // a negative scale means little endian data
+                file << "PF\n" << width << " " << height << "\n-1.0\n";
+                break;
+            case PNG: {
+                const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+                file.write(reinterpret_cast<const char *>(signature), 8);
+                vector<uint8_t> header;
+                putBigEndian(header, width);
+                putBigEndian(header, height);
+                header.insert(header.end(), {8, 2, 0, 0, 0}); // 8 bits RGB, no interlacing
+                writeChunk("IHDR", header);
+                previousRow.assign(3 * width, 0);
+                break;
+            }
+            case EXR: {
+                const uint8_t magic[4] = {0x76, 0x2f, 0x31, 0x01};
+                file.write(reinterpret_cast<const char *>(magic), 4);
+                putLittleEndian<int32_t>(2); // version 2, single part scanline image
+
+                // channels are stored in alphabetical order
+                vector<char> channels;
+                for (const char *name: {"B", "G", "R"}) {
+                    channels.insert(channels.end(), name, name + 2);
+                    const int32_t fields[4] = {2 /* FLOAT */, 0 /* pLinear and reserved */, 1, 1};
+                    channels.insert(channels.end(), reinterpret_cast<const char *>(fields),
+                                    reinterpret_cast<const char *>(fields) + sizeof(fields));
+                }
+                channels.push_back(0);
+                writeAttribute("channels", "chlist", channels.data(), (int) channels.size());
+                const uint8_t noCompression = 0;
+                writeAttribute("compression", "compression", &noCompression, 1);
+                const int32_t window[4] = {0, 0, width - 1, height - 1};
+                writeAttribute("dataWindow", "box2i", window, sizeof(window));
+                writeAttribute("displayWindow", "box2i", window, sizeof(window));
+                const uint8_t increasingY = 0;
+                writeAttribute("lineOrder", "lineOrder", &increasingY, 1);
+                const float one = 1.0f;
+                writeAttribute("pixelAspectRatio", "float", &one, sizeof(one));
+                const float center[2] = {0.0f, 0.0f};
+                writeAttribute("screenWindowCenter", "v2f", center, sizeof(center));
+                writeAttribute("screenWindowWidth", "float", &one, sizeof(one));
+                file.put(0);
+
+                // the scanlines are uncompressed, so their offsets are known in advance
+                const streamoff tableEnd = (streamoff) file.tellp() + 8 * height;
+                for (int y = 0; y < height; y++) {
+                    putLittleEndian<uint64_t>(tableEnd + (uint64_t) y * (8 + 12 * width));
+                }
+                break;
+            }
+        }
+        dataStart = file.tellp();
+    }
+
+    /**
+     Compresses the pending PNG rows into an IDAT chunk
+     @param last true for the last chunk, which also ends the zlib stream
+     */
+    void writePNGData(bool last) {
+        vector<uint8_t> bytes;
+        if (!zlibHeaderWritten) {
+            bytes = {0x78, 0x01}; // deflate, no preset dictionary
+            zlibHeaderWritten = true;
+        }
+        deflate.compress(pending.data(), pending.size(), last);
+        pending.clear();
+        vector<uint8_t> compressed = deflate.take();
+        bytes.insert(bytes.end(), compressed.begin(), compressed.end());
+        if (last) {
+            putBigEndian(bytes, (adler_b << 16) | adler_a);
+        }
+        writeChunk("IDAT", bytes);
+    }
+
+    static uint8_t paeth(int a, int b, int c) {
+        const int p = a + b - c;
+        const int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+        if (pa <= pb && pa <= pc) return a;
+        if (pb <= pc) return b;
+        return c;
+    }
+
+public:
+    /**
+     Gets the format used for a path, from its extension
+     */
+    static Format formatFromPath(const string &path) {
+        const size_t dot = path.find_last_of('.');
+        string extension = dot == string::npos ? "" : path.substr(dot + 1);
+        for (char &c: extension) {
+            c = (char) tolower(c);
+        }
+        if (extension == "png") return PNG;
+        if (extension == "pfm") return PFM;
+        if (extension == "exr") return EXR;
+        return PPM;
+    }
+
+    /**
+     @param path the path of the target image
+     @param width width of the image
+     @param height height of the image
+     */
+    ImageWriter(const char *path, int width, int height)
+            : format(formatFromPath(path)), width(width), height(height) {
+        file.open(path, ios::binary);
+        if (file.is_open()) {
+            writeHeader();
+        }
+    }
+
+    bool isOpen() const { return file.is_open(); }
+
+    /**
+     True if the format stores floating point colors
+     */
+    bool isHDR() const { return format == PFM || format == EXR; }
+
+    /**
+     Writes the next row of the image
+     @param rgb 8 bits colors of the row, used by the 8 bits formats
+     @param hdr floating point colors of the row, used by the floating point formats;
+     if nullptr, the 8 bits colors are used instead
+     */
+    void writeRow(const uint8_t *rgb, const float *hdr) {
+        vector<float> converted;
+        if (isHDR() && hdr == nullptr) {
+            converted.resize(3 * width);
+            for (int i = 0; i < 3 * width; i++) {
+                converted[i] = rgb[i] / 255.0f;
+            }
+            hdr = converted.data();
+        }
+
+        switch (format) {
+            case PPM:
+                file.write(reinterpret_cast<const char *>(rgb), 3 * width);
+                break;
+            case PFM:
+                // PFM rows go from the bottom of the image to the top
+                file.seekp(dataStart + (streamoff) (height - 1 - row) * 12 * width);
+                file.write(reinterpret_cast<const char *>(hdr), 12 * width);
+                break;
+            case EXR: {
+                putLittleEndian<int32_t>(row);
+                putLittleEndian<int32_t>(12 * width);
+                // the channels of a scanline are stored one after the other
+                vector<float> planar(3 * width);
+                for (int channel = 0; channel < 3; channel++) {
+                    for (int x = 0; x < width; x++) {
+                        planar[(2 - channel) * width + x] = hdr[3 * x + channel];
+                    }
+                }
+                file.write(reinterpret_cast<const char *>(planar.data()), 12 * width);
+                break;
+            }
+            case PNG: {
+                // pick the filter with the smallest sum of absolute values, a common heuristic
+                vector<uint8_t> best;
+                long bestScore = -1;
+                for (uint8_t filter = 0; filter < 5; filter++) {
+                    vector<uint8_t> filtered(3 * width + 1);
+                    filtered[0] = filter;
+                    long score = 0;
+                    for (int i = 0; i < 3 * width; i++) {
+                        const int a = i >= 3 ? rgb[i - 3] : 0;
+                        const int b = previousRow[i];
+                        const int c = i >= 3 ? previousRow[i - 3] : 0;
+                        uint8_t value = rgb[i];
+                        switch (filter) {
+                            case 1: value -= a; break;
+                            case 2: value -= b; break;
+                            case 3: value -= (a + b) / 2; break;
+                            case 4: value -= paeth(a, b, c); break;
+                        }
+                        filtered[i + 1] = value;
+                        score += value < 128 ? value : 256 - value;
+                    }
+                    if (bestScore < 0 || score < bestScore) {
+                        bestScore = score;
+                        best.swap(filtered);
+                    }
+                }
+                for (size_t i = 0; i < best.size(); i++) {
+                    adler_a = (adler_a + best[i]) % 65521;
+                    adler_b = (adler_b + adler_a) % 65521;
+                }
+                pending.insert(pending.end(), best.begin(), best.end());
+                previousRow.assign(rgb, rgb + 3 * width);
+                break;
+            }
+        }
+        row++;
+    }
+
+    /**
+     Compresses and writes the rows given so far, for formats that buffer them (PNG).
+     Every flush ends a deflate block, so it should not be called for every row.
+     */
+    void flush() {
+        if (format == PNG && !pending.empty()) {
+            writePNGData(false);
+        }
+        file.flush();
+    }
+
+    /**
+     Finishes the file, all the rows must have been written
+     @return false if the file could not be written, for instance on a full disk
+     */
+    bool close() {
+        if (!file.is_open()) {
+            return false;
+        }
+        if (format == PNG) {
+            writePNGData(true);
+            writeChunk("IEND", {});
+        }
+        file.close();
+        return !file.fail();
+    }
+};
 /**
  Class allowing for creating an image and writing it to a file
  */
@@ -22,38 +488,72 @@ class Image{
 
 private:
     int width, height; ///< width and height of the image
-    int *data; ///< a pointer to the data representing the images
-    
+    Framebuffer<RGB8> data; ///< the 8 bits tone mapped colors of the image
+    Framebuffer<RGB32F> hdrData; ///< linear colors before tone mapping, only kept for floating point outputs
+    bool keepHDR; ///< true if hdrData is allocated
+
 public:
     /**
      @param width with of the image
      @param height height of the image
+     @param keepHDR if true, the linear colors given to setHDRPixel are kept for floating point outputs
+     @param tileSize if not 0, the pixels are stored tile by tile with tiles of this size, so that threads
+     rendering different tiles do not share cache lines
      */
-    Image(int width, int height): width(width), height(height){
-        data = new int[3*width*height];
+    Image(int width, int height, bool keepHDR = false, int tileSize = 0)
+            : width(width), height(height), keepHDR(keepHDR){
+        const FramebufferLayout layout = tileSize > 0 ? FramebufferLayout::TileMajor : FramebufferLayout::RowMajor;
+        data = Framebuffer<RGB8>(width, height, layout, max(tileSize, 1));
+        if (keepHDR) {
+            hdrData = Framebuffer<RGB32F>(width, height, layout, max(tileSize, 1));
+        }
+    }
+
+    /**
+     True if a path asks for a floating point image format
+     */
+    static bool isHDRPath(const char *path){
+        ImageWriter::Format format = ImageWriter::formatFromPath(path);
+        return format == ImageWriter::PFM || format == ImageWriter::EXR;
     }
-    
+
     /**
-     Writes and image to a file in ppm format
+     Gets the size of the pixel data in bytes
+     */
+    size_t getBytes() const{
+        return data.getBytes() + (keepHDR ? hdrData.getBytes() : 0);
+    }
+
+    /**
+     Writes and image to a file, in a format chosen by the extension of the path
+     (ppm, png, pfm or exr, see ImageWriter)
      @param path the path where to the target image
+     @return true if the file could be written
      */
-    void writeImage(const char *path){
-        ofstream file;
-        file.open(path);
-        file << "P3" << endl;
-        file << width << " " << height <<endl;
-        file << 255 << endl;
+    bool writeImage(const char *path){
+        TraceScope trace("write image", path);
+        ImageWriter writer(path, width, height);
+        if (!writer.isOpen()) {
+            cout << "Could not write the image " << path << endl;
+            return false;
+        }
+        vector<RGB8> row(width);
+        vector<RGB32F> hdrRow(keepHDR ? width : 0);
         for(int h = 0; h < height; h++){
-            for (int w = 0; w < width; w++){
-                file << data[3 * (h*width + w)] <<" ";
-                file << data[3 * (h*width + w) + 1] <<" ";
-                file << data[3 * (h*width + w) + 2] << "  ";
+            data.readRow(h, row.data());
+            if (keepHDR) {
+                hdrData.readRow(h, hdrRow.data());
             }
-            file<<endl;
+            writer.writeRow(reinterpret_cast<const uint8_t *>(row.data()),
+                            keepHDR ? reinterpret_cast<const float *>(hdrRow.data()) : nullptr);
         }
-        file.close();
+        if (!writer.close()) {
+            cout << "Could not write the image " << path << endl;
+            return false;
+        }
+        return true;
     }
-    
+
     /**
      Set a value for one pixel
      @param x x coordinate of the pixel - index of the column counting from left to right
@@ -63,11 +563,12 @@ public:
      @param b blue chanel value in range from 0 to 255
      */
     void setPixel(int x, int y, int r, int g, int b){
-        data[3 * (y*width + x)] = r;
-        data[3 * (y*width + x) + 1] = g;
-        data[3 * (y*width + x) + 2] = b;
+        RGB8 &pixel = data.at(x, y);
+        pixel.r = (uint8_t) r;
+        pixel.g = (uint8_t) g;
+        pixel.b = (uint8_t) b;
     }
-    
+
     /**
      Set a value for one pixel
      @param x x coordinate of the pixel - index of the column counting from left to right
@@ -77,11 +578,9 @@ public:
      @param b blue chanel value in range from 0 to 1
      */
     void setPixel(int x, int y, float r, float g, float b){
-        data[3 * (y*width + x)] = (float)(255 * r);
-        data[3 * (y*width + x) + 1] = (float)(255 * g);
-        data[3 * (y*width + x) + 2] = (float)(255 * b);
+        data.at(x, y).set(glm::vec3(r, g, b));
     }
-    
+
     /**
      Set a value for one pixel
      @param x x coordinate of the pixel - index of the column counting from left to right
@@ -89,9 +588,163 @@ public:
      @param color color of the pixel expressed as vec3 of RGB values in range from 0 to 1
      */
     void setPixel(int x, int y, glm::vec3 color){
-        data[3 * (y*width + x)] = (float)(255 * color.r);
-        data[3 * (y*width + x) + 1] = (float)(255 * color.g);
-        data[3 * (y*width + x) + 2] = (float)(255 * color.b);
+        data.at(x, y).set(color);
+    }
+
+    /**
+     Set the linear color of one pixel before tone mapping, kept only if the image was created with keepHDR
+     @param x x coordinate of the pixel - index of the column counting from left to right
+     @param y y coordinate of the pixel - index of the row counting from top to bottom
+     @param color linear color of the pixel
+     */
+    void setHDRPixel(int x, int y, glm::vec3 color){
+        if (keepHDR) {
+            hdrData.at(x, y).set(color);
+        }
+    }
+};
+
+/**
+ FEAT: STREAMING OUTPUT
+ Writer streaming an image to a file tile by tile, so that the whole image never has to be in memory.
+ The image is cut into bands of rows, as high as the tiles. The tiles of a band can be given in any
+ order and from several threads; a band is written and freed as soon as it and all the bands above
+ it are complete. At most window bands are kept at once, a thread giving a tile further down waits
+ until the bands above it are written.
+ */
+class TileStreamWriter{
+
+private:
+    /**
+     Rows of the image waiting for their missing tiles or for the bands above them
+     */
+    struct Band{
+        vector<RGB8> pixels;       ///< 8 bits colors of the band
+        vector<RGB32F> hdrPixels;  ///< floating point colors of the band, for the floating point formats
+        int pixelsLeft;            ///< number of pixels not given yet
+    };
+
+    ImageWriter writer;       ///< writer of the file
+    int width, height;        ///< width and height of the image
+    int bandHeight;           ///< number of rows of a band
+    int bandOffset;           ///< number of rows by which the bands are shifted up, the first band is that much shorter
+    int window;               ///< maximum number of bands kept in memory
+    map<int, Band> bands;     ///< bands not written yet, by index
+    int nextBand = 0;         ///< index of the next band to be written
+    int peakBands = 0;        ///< maximum number of bands kept at once
+    mutex bandsMutex;         ///< guards the bands and the writer
+    condition_variable bandWritten; ///< signaled when bands have been written
+
+    /**
+     Gets the first row of a band
+     */
+    int bandStart(int index) const { return max(index * bandHeight - bandOffset, 0); }
+
+    /**
+     Gets the number of rows of a band
+     */
+    int bandRows(int index) const { return min((index + 1) * bandHeight - bandOffset, height) - bandStart(index); }
+
+    /**
+     Writes the complete bands following the last written one, must be called with bandsMutex locked
+     */
+    void writeBands(){
+        auto band = bands.find(nextBand);
+        while(band != bands.end() && band->second.pixelsLeft == 0){
+            const int rows = bandRows(nextBand);
+            for(int y = 0; y < rows; y++){
+                writer.writeRow(reinterpret_cast<const uint8_t *>(&band->second.pixels[y * width]),
+                                writer.isHDR() ? reinterpret_cast<const float *>(&band->second.hdrPixels[y * width])
+                                               : nullptr);
+            }
+            writer.flush();
+            bands.erase(band);
+            band = bands.find(++nextBand);
+        }
+        bandWritten.notify_all();
+    }
+
+public:
+    /**
+     @param path path of the file, the format is chosen by the extension (see ImageWriter)
+     @param width width of the image
+     @param height height of the image
+     @param bandHeight height of the tiles, a tile must not cross the border between two bands
+     @param window maximum number of bands kept in memory
+     @param bandOffset row of the tile grid at which the image starts, for images cropped out of a larger
+     one; the first band then only has bandHeight - bandOffset rows
+     */
+    TileStreamWriter(const char *path, int width, int height, int bandHeight, int window, int bandOffset = 0)
+            : writer(path, width, height), width(width), height(height), bandHeight(bandHeight),
+              bandOffset(bandOffset), window(max(window, 1)){
+    }
+
+    bool isOpen() const { return writer.isOpen(); }
+
+    /**
+     True if the floating point colors of the tiles are written
+     */
+    bool isHDR() const { return writer.isHDR(); }
+
+    /**
+     Gets the maximum number of bands that were kept in memory at once
+     */
+    int getPeakBands() const { return peakBands; }
+
+    /**
+     Gets the size of one band in bytes
+     */
+    size_t getBandBytes() const{
+        return (size_t) width * bandHeight * (sizeof(RGB8) + (writer.isHDR() ? sizeof(RGB32F) : 0));
+    }
+
+    /**
+     Gives the colors of a tile, writing the bands it completes
+     @param x0 x coordinate of the left column of the tile
+     @param y0 y coordinate of the top row of the tile
+     @param x1 x coordinate after the right column of the tile
+     @param y1 y coordinate after the bottom row of the tile
+     @param pixels 8 bits colors of the tile, row by row
+     @param hdrPixels floating point colors of the tile, row by row; only read when isHDR()
+     */
+    void writeTile(int x0, int y0, int x1, int y1, const RGB8 *pixels, const RGB32F *hdrPixels){
+        const int index = (y0 + bandOffset) / bandHeight;
+        unique_lock<mutex> lock(bandsMutex);
+        bandWritten.wait(lock, [&]() { return index < nextBand + window; });
+
+        auto inserted = bands.emplace(index, Band());
+        Band &band = inserted.first->second;
+        if(inserted.second){
+            const int rows = bandRows(index);
+            band.pixels.resize((size_t) width * rows);
+            band.hdrPixels.resize(writer.isHDR() ? (size_t) width * rows : 0);
+            band.pixelsLeft = width * rows;
+            peakBands = max(peakBands, (int) bands.size());
+        }
+
+        const int tileWidth = x1 - x0;
+        for(int y = y0; y < y1; y++){
+            const size_t offset = (size_t) (y - bandStart(index)) * width + x0;
+            copy(pixels + (y - y0) * tileWidth, pixels + (y - y0 + 1) * tileWidth, band.pixels.begin() + offset);
+            if(writer.isHDR()){
+                copy(hdrPixels + (y - y0) * tileWidth, hdrPixels + (y - y0 + 1) * tileWidth,
+                     band.hdrPixels.begin() + offset);
+            }
+        }
+        band.pixelsLeft -= tileWidth * (y1 - y0);
+        writeBands();
+    }
+
+    /**
+     Finishes the file, all the tiles must have been given
+     @return false if the file could not be written
+     */
+    bool close(){
+        lock_guard<mutex> lock(bandsMutex);
+        if(bandStart(nextBand) < height){
+            cout << "The streamed image is missing rows from row " << bandStart(nextBand) << endl;
+        }
+        return writer.close();
     }
 };
 
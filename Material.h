@@ -5,6 +5,11 @@
 #ifndef Material_h
 #define Material_h
 
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
 #include "Textures.h"
 #include "glm/glm.hpp"
 
@@ -41,4 +46,63 @@ struct Material {
     float_t (*occlusion)(glm::vec2 uv) = nullptr;
 };
 
+/**
+ Features of a material that change the shading code. Together they form the kind of the material,
+ the index of the shading kernel compiled for that combination of features.
+ */
+enum ShadingFeature : unsigned {
+    SHADE_IMAGE_TEXTURE = 1u << 0, ///< roughness and occlusion read from the image textures
+    SHADE_ANISOTROPIC = 1u << 1,   ///< Ward anisotropic highlights instead of Phong ones
+    SHADE_TEXTURE = 1u << 2,       ///< diffuse color read from a texture function
+    SHADE_REFLECTION = 1u << 3,    ///< reflected rays
+    SHADE_REFRACTION = 1u << 4,    ///< refracted rays
+};
+constexpr unsigned SHADING_KINDS = 1u << 5; ///< Number of combinations of the shading features
+
+/**
+ Kind of a material, the index of its shading kernel
+ */
+inline unsigned shadingKind(const Material &material) {
+    return (material.hasImgTexture ? SHADE_IMAGE_TEXTURE : 0u) | (material.isAnisotropic ? SHADE_ANISOTROPIC : 0u) |
+           (material.texture != nullptr ? SHADE_TEXTURE : 0u) | (material.reflection > 0 ? SHADE_REFLECTION : 0u) |
+           (material.refraction > 0 ? SHADE_REFRACTION : 0u);
+}
+
+/**
+ Index of a material in the material table
+ */
+using MaterialId = uint16_t;
+
+/**
+ Table of the materials of the scene, filled while the scene is built and only read while rendering.
+ The objects and the hits refer to their material by its index, the first entry is the default material.
+ */
+std::vector<Material> materialTable{Material()};
+
+/**
+ Kinds of the materials of the material table, indexed like the table
+ */
+std::vector<uint8_t> materialKinds{(uint8_t) shadingKind(Material())};
+
+/**
+ Names of the materials of the material table, indexed like the table
+ */
+std::vector<std::string> materialNames{"default"};
+
+/**
+ Adds a material to the material table
+ @param name Name of the material in the scene file
+ @return Index of the material, or of the default material if the table is full
+ */
+inline MaterialId addMaterial(const Material &material, const std::string &name = "unnamed") {
+    if (materialTable.size() > UINT16_MAX) {
+        std::cout << "Too many materials, the default material is used instead" << std::endl;
+        return 0;
+    }
+    materialTable.push_back(material);
+    materialKinds.push_back((uint8_t) shadingKind(material));
+    materialNames.push_back(name);
+    return (MaterialId) (materialTable.size() - 1);
+}
+
 #endif /* Material_h */
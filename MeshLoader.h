@@ -2,6 +2,8 @@
 #define MESHLOADER_H
 
 #include "Object.h"
+#include "Profiler.h"
+#include "Stats.h"
 #include <cmath>
 #include <fstream>
 #include <vector>
@@ -24,7 +26,7 @@
  * We decided to fix it for the competition.
  **/
 
-class Triangle : public Object {
+class Triangle final : public Object {
 private:
     glm::vec3 vertexA;
     glm::vec3 vertexB;
@@ -67,9 +69,8 @@ public:
                              textureB != glm::vec2(0.0f) ||
                              textureC != glm::vec2(0.0f)) {}
 
-    Hit intersect(Ray &ray) override {
-        Hit hit{};
-        hit.hit = false;
+    HitRecord findHit(Ray &ray) override {
+        HitRecord hit;
 
         float ddotN = glm::dot(ray.direction, normal);
         if (ddotN == 0) {
@@ -96,6 +97,24 @@ public:
             return hit; // outside the triangle
         }
 
+        hit.distance = t;
+        hit.object = this;
+        return hit;
+    }
+
+    /**
+     Computes the normal and the texture coordinates at an intersection found by findHit,
+     the sub-triangles are computed again from the distance of the intersection
+    */
+    Hit surfaceAt(Ray &ray, const HitRecord &record) override {
+        Hit hit{};
+
+        glm::vec3 td = ray.origin + record.distance * ray.direction;
+
+        glm::vec3 w0 = glm::cross(vertexB - td, vertexC - td); //
+        glm::vec3 w1 = glm::cross(vertexC - td, vertexA - td); //
+        glm::vec3 w2 = glm::cross(vertexA - td, vertexB - td); //
+
         if (vertexNormals) {
             float a0 = glm::length(w0) * (glm::dot(normal, w0) >= 0 ? 1 : -1) * 0.5; //
             float a1 = glm::length(w1) * (glm::dot(normal, w1) >= 0 ? 1 : -1) * 0.5; //
@@ -107,8 +126,9 @@ public:
         }
 
         hit.intersection = td;
-        hit.distance = t;
+        hit.distance = record.distance;
         hit.object = this;
+        hit.material = material;
         hit.hit = true;
         hit.normalShading = normal;
 
@@ -124,7 +144,7 @@ public:
     }
 };
 
-class BoundingBox : public Object {
+class BoundingBox final : public Object {
 private:
     glm::vec3 minBounds = glm::vec3(INFINITY);
     glm::vec3 maxBounds = glm::vec3(-INFINITY);
@@ -134,9 +154,12 @@ public:
 
     BoundingBox(glm::vec3 &minBounds, glm::vec3 &maxBounds) : minBounds(minBounds), maxBounds(maxBounds) {}
 
-    explicit BoundingBox(std::vector<Triangle> &triangles) {
-        for (const Triangle &t: triangles) {
-            for (const glm::vec3 &vertex: t.vertices) {
+    /**
+     Box around the triangles of a mesh with the given indices
+    */
+    BoundingBox(const std::vector<Triangle> &triangles, const std::vector<uint32_t> &indices) {
+        for (uint32_t index: indices) {
+            for (const glm::vec3 &vertex: triangles[index].vertices) {
                 minBounds.x = std::min(minBounds.x, vertex.x);
                 minBounds.y = std::min(minBounds.y, vertex.y);
                 minBounds.z = std::min(minBounds.z, vertex.z);
@@ -148,7 +171,22 @@ public:
         }
     }
 
-    Hit intersect(Ray &ray) override {
+    HitRecord findHit(Ray &ray) override {
+        HitRecord record;
+        Hit hit = slabIntersection(ray);
+        if (hit.hit) {
+            record.distance = hit.distance;
+            record.object = this;
+        }
+        return record;
+    }
+
+    Hit surfaceAt(Ray &ray, const HitRecord &) override {
+        return slabIntersection(ray);
+    }
+
+private:
+    Hit slabIntersection(Ray &ray) {
         Hit hit{};
         hit.hit = false;
 
@@ -213,24 +251,25 @@ private:
     BoundingBox *boundingBox;
     bvh_node *leftChild;
     bvh_node *rightChild;
-    std::vector<Triangle> triangles; // store triangles in leaf nodes
+    std::vector<uint32_t> triangles; // indices of the triangles of the mesh in leaf nodes
 
-    std::pair<std::vector<Triangle>, std::vector<Triangle>> static splitMesh(std::vector<Triangle> &mesh, int a) {
-        std::vector<Triangle> left;
-        std::vector<Triangle> right;
+    std::pair<std::vector<uint32_t>, std::vector<uint32_t>> static splitMesh(const std::vector<Triangle> &mesh,
+                                                                             std::vector<uint32_t> &indices, int a) {
+        std::vector<uint32_t> left;
+        std::vector<uint32_t> right;
 
         float c = 0;
-        for (const Triangle &m: mesh) {
-            for (const glm::vec3 &vertex: m.vertices) {
+        for (uint32_t index: indices) {
+            for (const glm::vec3 &vertex: mesh[index].vertices) {
                 c += vertex[a];
             }
         }
-        c /= mesh.size() * 3;
+        c /= indices.size() * 3;
 
-        for (const Triangle &m: mesh) {
+        for (uint32_t index: indices) {
             bool isLeft = false; // determine if triangle belongs to left side
 
-            for (const glm::vec3 &vertex: m.vertices) {
+            for (const glm::vec3 &vertex: mesh[index].vertices) {
                 if (vertex[a] < c) {
                     isLeft = true; // at least one vertex is on the left side
                     break;
@@ -238,86 +277,133 @@ private:
             }
 
             if (isLeft) {
-                left.push_back(m);
+                left.push_back(index);
             } else {
-                right.push_back(m);
+                right.push_back(index);
             }
         }
         return {left, right};
     }
 
 public:
-    explicit bvh_node(std::vector<Triangle> &mesh, int a = 0) {
+    /**
+     Builds the hierarchy over the triangles of a mesh with the given indices, the leaves
+     only store the indices so the triangles are not copied
+    */
+    bvh_node(const std::vector<Triangle> &mesh, std::vector<uint32_t> &indices, int a = 0) {
         int maxSize = 100;
-        boundingBox = new BoundingBox(mesh);
+        boundingBox = new BoundingBox(mesh, indices);
 
-        if (mesh.size() <= maxSize) {
+        if (indices.size() <= maxSize) {
             leftChild = nullptr;
             rightChild = nullptr;
-            triangles = mesh;
+            triangles = indices;
         } else {
-            std::pair<std::vector<Triangle>, std::vector<Triangle>> objs = splitMesh(mesh, a);
-            leftChild = new bvh_node(objs.first, (a + 1) % 3);
-            rightChild = new bvh_node(objs.second, (a + 1) % 3);
+            std::pair<std::vector<uint32_t>, std::vector<uint32_t>> objs = splitMesh(mesh, indices, a);
+            leftChild = new bvh_node(mesh, objs.first, (a + 1) % 3);
+            rightChild = new bvh_node(mesh, objs.second, (a + 1) % 3);
         }
     }
 
-    std::vector<Triangle> bhv_intersect(bvh_node *node, Ray &ray) {
+    /**
+     Calls visitor with the index of every triangle in the leaves whose boxes are hit by the ray,
+     the left child before the right one
+    */
+    template<typename Visitor>
+    void bhv_intersect(bvh_node *node, Ray &ray, Visitor &visitor) {
         // leaf node
-        if (node->leftChild == nullptr && node->rightChild == nullptr)
-            return node->triangles;
-
-        bool leftHit = node->leftChild->boundingBox->intersect(ray).hit;
-        bool rightHit = node->rightChild->boundingBox->intersect(ray).hit;
-
-        if (leftHit && rightHit) {
-            std::vector<Triangle> left = bhv_intersect(node->leftChild, ray);
-            std::vector<Triangle> right = bhv_intersect(node->rightChild, ray);
-            left.insert(left.end(), right.begin(), right.end());
-            return left;
-        } else if (leftHit) {
-            return bhv_intersect(node->leftChild, ray);
-        } else if (rightHit) {
-            return bhv_intersect(node->rightChild, ray);
+        if (node->leftChild == nullptr && node->rightChild == nullptr) {
+            STATS(threadStats().bvhLeaves++; threadStats().leafTriangles += (long) node->triangles.size());
+            for (uint32_t index: node->triangles) {
+                visitor(index);
+            }
+            return;
+        }
+
+        bool leftHit = node->leftChild->boundingBox->findHit(ray).hit();
+        bool rightHit = node->rightChild->boundingBox->findHit(ray).hit();
+        STATS(threadStats().bvhNodes += 2; threadStats().bvhNodeHits += leftHit + rightHit);
+
+        if (leftHit) {
+            bhv_intersect(node->leftChild, ray, visitor);
+        }
+        if (rightHit) {
+            bhv_intersect(node->rightChild, ray, visitor);
         }
-        return node->triangles;
     }
 };
 
+/**
+ * @brief Corners of a triangle as read from an .obj file, the normals and texture
+ * coordinates are 0 when the file does not give them.
+ */
+struct TriangleCorners {
+    glm::vec3 positions[3];
+    glm::vec3 normals[3];
+    glm::vec2 uvs[3];
+};
+
 /*
   Takes an Obj file and parses it, creating a list of Triangles
 */
-class MeshLoader : public Object {
+class MeshLoader final : public Object {
 private:
-    std::vector<glm::vec3> vertices;
-    std::vector<glm::vec3> normals;
-    std::vector<glm::vec2> textureCoords;
     std::vector<Triangle> triangles;
     BoundingBox boundingBox;
-    bvh_node *node;
-
-public:
-    MeshLoader(const std::string &filename, glm::vec3 translation, bool hasMaterial, Material material = Material()) {
-
-        if (hasMaterial) {
-            this->setMaterial(material);
+    bvh_node *node = nullptr;
+
+    void build(const std::vector<TriangleCorners> &corners, glm::vec3 minBounds, glm::vec3 maxBounds,
+               bool hasMaterial, MaterialId material) {
+        TraceScope trace("build BVH", std::to_string(corners.size()) + " triangles");
+        triangles.reserve(corners.size());
+        for (const TriangleCorners &c: corners) {
+            Triangle triangle = Triangle(c.positions[0], c.positions[1], c.positions[2],
+                                         c.normals[0], c.normals[1], c.normals[2],
+                                         c.uvs[0], c.uvs[1], c.uvs[2]);
+            if (hasMaterial) {
+                triangle.setMaterial(material);
+            }
+            triangles.push_back(triangle);
+        }
+        boundingBox = BoundingBox(minBounds, maxBounds);
+        std::vector<uint32_t> indices(triangles.size());
+        for (uint32_t i = 0; i < indices.size(); i++) {
+            indices[i] = i;
         }
+        node = new bvh_node(triangles, indices);
+    }
 
+public:
+    /**
+     * @brief Parses an .obj file into the corners of its triangles.
+     * @param filename Path of the .obj file.
+     * @param translation Offset added to the vertices (and, as the scenes were tuned with it, to the normals).
+     * @param corners Corners of the triangles, in the order of the faces.
+     * @param minBounds Smallest coordinates of the vertices.
+     * @param maxBounds Largest coordinates of the vertices.
+     * @return False if the file could not be opened.
+     */
+    static bool readObj(const std::string &filename, glm::vec3 translation, std::vector<TriangleCorners> &corners,
+                        glm::vec3 &minBounds, glm::vec3 &maxBounds) {
+        TraceScope trace("load mesh", filename);
         std::ifstream file(filename);
 
         if (!file.is_open()) {
             std::cout << "Could not open file " << filename << std::endl;
-            return;
+            return false;
         }
 
+        std::vector<glm::vec3> vertices;
+        std::vector<glm::vec3> normals;
+        std::vector<glm::vec2> textureCoords;
         std::string line;
 
         float x, y, z, nx, ny, nz, tx, ty, tz;
         int smoothShading = 0;
         bool hasTexture = false;
 
-        glm::vec3 minBounds = glm::vec3(INFINITY);
-        glm::vec3 maxBounds = glm::vec3(-INFINITY);
+        minBounds = glm::vec3(INFINITY);
+        maxBounds = glm::vec3(-INFINITY);
 
         while (getline(file, line)) {
             if (line[1] == 'n') {
@@ -343,68 +429,93 @@ public:
                 sscanf(line.c_str(), "s %d", &smoothShading);
             } else if (line[0] == 'f') {
                 // face
+                TriangleCorners triangle{};
                 // if smoothShading == 0, there are no normals
+                // likely wont have texture vertices if it doesnt have normal vertices
                 if (smoothShading == 0) {
-                    /*if (hasTexture) { // likely wont have texture vertices if it doesnt have normal vertices
-                        sscanf(line.c_str(), "f %f %f %f", &x, &y, &z);
-                        Triangle triangle = Triangle(vertices[x - 1], vertices[y - 1], vertices[z - 1]);
-                        if (hasMaterial) {
-                            triangle.setMaterial(material);
-                        }
-                        triangles.push_back(triangle);
-                    } else {*/
                     sscanf(line.c_str(), "f %f %f %f", &x, &y, &z);
-                    Triangle triangle = Triangle(vertices[x - 1], vertices[y - 1], vertices[z - 1]);
-                    if (hasMaterial) {
-                        triangle.setMaterial(material);
-                    }
-                    triangles.push_back(triangle);
+                } else if (hasTexture) {
+                    sscanf(line.c_str(), "f %f/%f/%f %f/%f/%f %f/%f/%f", &x, &tx, &nx, &y, &ty, &ny, &z, &tz, &nz);
+                    triangle.normals[0] = normals[nx - 1];
+                    triangle.normals[1] = normals[ny - 1];
+                    triangle.normals[2] = normals[nz - 1];
+                    triangle.uvs[0] = textureCoords[tx - 1];
+                    triangle.uvs[1] = textureCoords[ty - 1];
+                    triangle.uvs[2] = textureCoords[tz - 1];
                 } else {
-                    if (hasTexture) {
-                        sscanf(line.c_str(), "f %f/%f/%f %f/%f/%f %f/%f/%f", &x, &tx, &nx, &y, &ty, &ny, &z, &tz, &nz);
-
-                        Triangle triangle = Triangle(vertices[x - 1], vertices[y - 1], vertices[z - 1],
-                                                     normals[nx - 1], normals[ny - 1], normals[nz - 1],
-                                                     textureCoords[tx - 1], textureCoords[ty - 1],
-                                                     textureCoords[tz - 1]);
-                        if (hasMaterial) {
-                            triangle.setMaterial(material);
-                        }
-                        triangles.push_back(triangle);
-                    } else {
-                        sscanf(line.c_str(), "f %f//%f %f//%f %f//%f", &x, &nx, &y, &ny, &z, &nz);
-
-                        Triangle triangle = Triangle(vertices[x - 1], vertices[y - 1], vertices[z - 1], normals[nx - 1],
-                                                     normals[ny - 1], normals[nz - 1]);
-                        if (hasMaterial) {
-                            triangle.setMaterial(material);
-                        }
-                        triangles.push_back(triangle);
-                    }
+                    sscanf(line.c_str(), "f %f//%f %f//%f %f//%f", &x, &nx, &y, &ny, &z, &nz);
+                    triangle.normals[0] = normals[nx - 1];
+                    triangle.normals[1] = normals[ny - 1];
+                    triangle.normals[2] = normals[nz - 1];
                 }
+                triangle.positions[0] = vertices[x - 1];
+                triangle.positions[1] = vertices[y - 1];
+                triangle.positions[2] = vertices[z - 1];
+                corners.push_back(triangle);
             }
         }
-        file.close();
-        boundingBox = BoundingBox(minBounds, maxBounds);
-        node = new bvh_node(triangles);
+        return true;
     }
 
-    Hit intersect(Ray &ray) override {
-        Hit closest_hit{};
-        closest_hit.hit = false;
-        closest_hit.distance = INFINITY;
-        if (!boundingBox.intersect(ray).hit) {
+    MeshLoader(const std::string &filename, glm::vec3 translation, bool hasMaterial, MaterialId material = 0) {
+
+        if (hasMaterial) {
+            this->setMaterial(material);
+        }
+
+        std::vector<TriangleCorners> corners;
+        glm::vec3 minBounds, maxBounds;
+        if (readObj(filename, translation, corners, minBounds, maxBounds)) {
+            build(corners, minBounds, maxBounds, hasMaterial, material);
+        }
+    }
+
+    /**
+     * @brief Constructor for a mesh whose .obj file was already parsed, for instance by a compiled scene.
+     * @param corners Corners of the triangles.
+     * @param minBounds Smallest coordinates of the vertices.
+     * @param maxBounds Largest coordinates of the vertices.
+     */
+    MeshLoader(const std::vector<TriangleCorners> &corners, glm::vec3 minBounds, glm::vec3 maxBounds,
+               bool hasMaterial, MaterialId material = 0) {
+        if (hasMaterial) {
+            this->setMaterial(material);
+        }
+        build(corners, minBounds, maxBounds, hasMaterial, material);
+    }
+
+    HitRecord findHit(Ray &ray) override {
+        HitRecord closest_hit;
+        // the mesh could not be loaded, there is nothing to intersect
+        if (node == nullptr) {
+            return closest_hit;
+        }
+        STATS(threadStats().bvhNodes++);
+        if (!boundingBox.findHit(ray).hit()) {
             return closest_hit;
         }
-        for (Triangle &t: node->bhv_intersect(node, ray)) {
-            Hit intersection = t.intersect(ray);
-            if (intersection.hit && intersection.distance < closest_hit.distance) {
+        STATS(threadStats().bvhNodeHits++);
+        auto intersectTriangle = [&](uint32_t index) {
+            HitRecord intersection = triangles[index].findHit(ray);
+            STATS(threadStats().triangleTests++; threadStats().triangleHits += intersection.hit());
+            if (intersection.hit() && intersection.distance < closest_hit.distance) {
                 closest_hit = intersection;
+                closest_hit.primitive = index;
             }
+        };
+        node->bhv_intersect(node, ray, intersectTriangle);
+        if (closest_hit.hit()) {
+            closest_hit.object = this;
         }
-        closest_hit.object = this;
         return closest_hit;
     }
+
+    Hit surfaceAt(Ray &ray, const HitRecord &record) override {
+        Hit hit = triangles[record.primitive].surfaceAt(ray, record);
+        hit.object = this;
+        hit.material = material;
+        return hit;
+    }
 };
 
 #endif
\ No newline at end of file
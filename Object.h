@@ -23,34 +23,59 @@ public:
     // Color of the object.
     glm::vec3 color;
 
-    // Structure describing the material of the object.
-    Material material;
+    // Index of the material of the object in the material table.
+    MaterialId material = 0;
+
+    /**
+     * @brief Finds the intersection of the object with a given ray, without
+     * computing the surface at the intersection point.
+     * @param ray The ray to check for intersection.
+     * @return The HitRecord structure representing the intersection.
+     */
+    virtual HitRecord findHit(Ray &ray) = 0;
+
+    /**
+     * @brief Computes the surface at an intersection found by findHit.
+     * @param ray The ray given to findHit.
+     * @param record The intersection returned by findHit.
+     * @return The Hit structure representing the intersection.
+     */
+    virtual Hit surfaceAt(Ray &ray, const HitRecord &record) = 0;
 
     /**
      * @brief Computes the intersection of the object with a given ray.
      * @param ray The ray to check for intersection.
      * @return The Hit structure representing the intersection.
      */
-    virtual Hit intersect(Ray &ray) = 0;
+    Hit intersect(Ray &ray) {
+        HitRecord record = findHit(ray);
+        if (!record.hit()) {
+            Hit hit{};
+            hit.hit = false;
+            hit.distance = INFINITY;
+            return hit;
+        }
+        return surfaceAt(ray, record);
+    }
 
     /**
      * @brief Gets the material structure of the object.
-     * @return The Material structure describing the material of the object.
+     * @return The Material structure describing the material of the object, in the material table.
      */
-    Material getMaterial() const { return material; }
+    const Material &getMaterial() const { return materialTable[material]; }
 
     /**
      * @brief Sets the material of the object.
-     * @param material A structure describing the material of the object.
+     * @param newMaterial Index of the material in the material table.
      */
-    void setMaterial(Material newMaterial) { this->material = newMaterial; }
+    void setMaterial(MaterialId newMaterial) { this->material = newMaterial; }
 
     /**
      * @brief Sets up all the transformation matrices for the object.
      * @param matrix The matrix representing the transformation of the object in
      * global coordinates.
      */
-    void setTransformation(glm::mat4 matrix) {
+    virtual void setTransformation(glm::mat4 matrix) {
         transformationMatrix = matrix;
         inverseTransformationMatrix = glm::inverse(transformationMatrix);
         normalMatrix = glm::transpose(inverseTransformationMatrix);
@@ -2,14 +2,26 @@
 #ifndef OBJECTS_H
 #define OBJECTS_H
 
+#include <algorithm>
 #include <cmath>
 
 #include "Object.h"
 
+/**
+ * @brief Kinds of transformations of the spheres, from the simplest to the most
+ * general. They tell when the matrices are not needed to intersect the sphere.
+ */
+enum TransformationKind {
+    TRANSFORM_IDENTITY,
+    TRANSFORM_TRANSLATION,
+    TRANSFORM_UNIFORM_SCALE, ///< Translation and positive uniform scale
+    TRANSFORM_AFFINE,        ///< Any other transformation
+};
+
 /**
  * @brief Class representing a sphere object.
  */
-class Sphere : public Object {
+class Sphere final : public Object {
 private:
     // Radius of the sphere
     float radius = 1.0;
@@ -17,6 +29,16 @@ private:
     // Center of the sphere
     glm::vec3 center = glm::vec3(0.0);
 
+    // Kind of the transformation, the translation and the scale below are only
+    // used if it is not TRANSFORM_AFFINE.
+    TransformationKind transformationKind = TRANSFORM_IDENTITY;
+
+    // Translation of the transformation.
+    glm::vec3 translation = glm::vec3(0.0f);
+
+    // Scale of the transformation, the same along every axis.
+    float uniformScale = 1.0f;
+
 public:
     /**
      * @brief Constructor for the sphere with a specified color.
@@ -26,16 +48,66 @@ public:
 
     /**
      * @brief Constructor for the sphere with a specified material.
-     * @param material Material of the sphere.
+     * @param material Index of the material of the sphere in the material table.
      */
-    explicit Sphere(Material material) { this->material = material; }
+    explicit Sphere(MaterialId material) { this->material = material; }
+
+    /**
+     * @brief Sets up the transformation matrices and finds the kind of the transformation.
+     * @param matrix The matrix representing the transformation of the sphere in
+     * global coordinates.
+     */
+    void setTransformation(glm::mat4 matrix) override {
+        Object::setTransformation(matrix);
+
+        // the linear part must be a multiple of the identity, and the last row (0, 0, 0, 1)
+        const float scale = matrix[0][0];
+        bool uniform = scale > 0 && matrix[1][1] == scale && matrix[2][2] == scale && matrix[3][3] == 1;
+        for (int column = 0; column < 3; column++) {
+            for (int row = 0; row < 4; row++) {
+                if (row != column && matrix[column][row] != 0) {
+                    uniform = false;
+                }
+            }
+        }
+        translation = glm::vec3(matrix[3]);
+        uniformScale = scale;
+        if (!uniform) {
+            transformationKind = TRANSFORM_AFFINE;
+        } else if (scale != 1) {
+            transformationKind = TRANSFORM_UNIFORM_SCALE;
+        } else if (translation != glm::vec3(0.0f)) {
+            transformationKind = TRANSFORM_TRANSLATION;
+        } else {
+            transformationKind = TRANSFORM_IDENTITY;
+        }
+    }
 
     /**
-     * @brief Implementation of the intersection function.
+     * @brief Implementation of the intersection function. The spheres that are only moved and
+     * scaled, as in the scenes, are intersected in world coordinates without the matrices.
      * @param ray The ray to check for intersection.
+     * @return The HitRecord structure representing the intersection.
+     */
+    HitRecord findHit(Ray &ray) override {
+        return transformationKind == TRANSFORM_AFFINE ? findLocalHit(ray) : findWorldHit(ray);
+    }
+
+    /**
+     * @brief Computes the surface of the sphere at an intersection.
+     * @param ray The ray given to findHit.
+     * @param record The intersection returned by findHit.
      * @return The Hit structure representing the intersection.
      */
-    Hit intersect(Ray &ray) override {
+    Hit surfaceAt(Ray &ray, const HitRecord &record) override {
+        return transformationKind == TRANSFORM_AFFINE ? localSurfaceAt(ray, record) : worldSurfaceAt(ray, record);
+    }
+
+private:
+    /**
+     * @brief Intersection in the local coordinates of the sphere, for any transformation.
+     */
+    HitRecord findLocalHit(Ray &ray) {
 
         glm::vec3 newOrigin =
                 glm::vec3(inverseTransformationMatrix * glm::vec4(ray.origin, 1.0));
@@ -46,7 +118,7 @@ public:
         float cdotc = glm::dot(c, c);
         float cdotd = glm::dot(c, newDirection);
 
-        Hit hit{};
+        HitRecord hit;
 
         double D = 0;
         if (cdotc > cdotd * cdotd) {
@@ -54,59 +126,137 @@ public:
         }
 
         if (D <= radius) {
-            hit.hit = true;
             float t1 = cdotd - sqrt(radius * radius - D * D);
             float t2 = cdotd + sqrt(radius * radius - D * D);
 
             float t = (t1 < 0) ? t2 : t1;
             if (t < 0) {
-                hit.hit = false;
                 return hit;
             }
 
             glm::vec3 newIntersection = newOrigin + t * newDirection;
-            glm::vec3 newNormal = glm::normalize(newIntersection - center);
-
-            hit.intersection =
+            glm::vec3 intersection =
                     glm::vec3(transformationMatrix * glm::vec4(newIntersection, 1.0));
-            hit.distance = glm::distance(ray.origin, hit.intersection);
+            hit.distance = glm::distance(ray.origin, intersection);
             hit.object = this;
+            hit.t = t;
+        }
+        return hit;
+    }
 
-            glm::vec3 newNormalGlobal =
-                    glm::normalize(glm::vec3(normalMatrix * glm::vec4(newNormal, 0.0)));
-            hit.normal = newNormalGlobal;
-            hit.normalShading = newNormalGlobal;
+    /**
+     * @brief Surface at an intersection found by findLocalHit.
+     */
+    Hit localSurfaceAt(Ray &ray, const HitRecord &record) {
 
-            hit.uv.s = (asin(newNormal.y) + M_PI / 2) / M_PI;
-            hit.uv.t = (atan2(newNormal.z, newNormal.x) + M_PI) / (2 * M_PI);
+        glm::vec3 newOrigin =
+                glm::vec3(inverseTransformationMatrix * glm::vec4(ray.origin, 1.0));
+        glm::vec3 newDirection = glm::normalize(
+                glm::vec3(inverseTransformationMatrix * glm::vec4(ray.direction, 0.0)));
 
-            // FEAT: NORMAL MAPS
-            if (material.hasNormalMap) {
-                glm::vec3 tangent = glm::normalize(glm::cross(glm::vec3(0.0f, 1.0f, 0.0f), hit.intersection));
-                glm::vec3 bitangent = glm::normalize(glm::cross(hit.normal, tangent));
-                hit.tangent = tangent;
-                hit.bitangent = bitangent;
+        Hit hit{};
+        hit.hit = true;
 
-                glm::vec3 normal_map = glm::normalize(material.normalMap(hit.uv));
+        glm::vec3 newIntersection = newOrigin + record.t * newDirection;
+        glm::vec3 newNormal = glm::normalize(newIntersection - center);
 
-                glm::mat3 TBN = glm::mat3(tangent, bitangent, hit.normal);
+        hit.intersection =
+                glm::vec3(transformationMatrix * glm::vec4(newIntersection, 1.0));
+        hit.distance = record.distance;
+        hit.object = this;
+        hit.material = material;
 
-                hit.normalShading = glm::normalize(TBN * normal_map);
-            }
+        glm::vec3 newNormalGlobal =
+                glm::normalize(glm::vec3(normalMatrix * glm::vec4(newNormal, 0.0)));
+        hit.normal = newNormalGlobal;
+        hit.normalShading = newNormalGlobal;
 
+        hit.uv.s = (asin(newNormal.y) + M_PI / 2) / M_PI;
+        hit.uv.t = (atan2(newNormal.z, newNormal.x) + M_PI) / (2 * M_PI);
 
+        applyNormalMap(hit);
+        return hit;
+    }
 
-        } else {
-            hit.hit = false;
+    /**
+     * @brief Intersection in world coordinates, for a translation and a uniform scale. The
+     * center and the radius are moved instead of the ray, the directions of the rays being
+     * unit vectors the parameter along the ray is the distance.
+     */
+    HitRecord findWorldHit(Ray &ray) {
+        glm::vec3 worldCenter = translation + uniformScale * center;
+        float worldRadius = uniformScale * radius;
+
+        glm::vec3 c = worldCenter - ray.origin;
+        float cdotc = glm::dot(c, c);
+        float cdotd = glm::dot(c, ray.direction);
+
+        HitRecord hit;
+
+        // squared distance between the center and the ray
+        float D2 = std::max(cdotc - cdotd * cdotd, 0.0f);
+        if (D2 > worldRadius * worldRadius) {
+            return hit;
         }
+
+        float h = std::sqrt(worldRadius * worldRadius - D2);
+        float t = (cdotd - h < 0) ? cdotd + h : cdotd - h;
+        if (t < 0) {
+            return hit;
+        }
+
+        hit.distance = t;
+        hit.object = this;
+        hit.t = t;
+        return hit;
+    }
+
+    /**
+     * @brief Surface at an intersection found by findWorldHit, the normal in world
+     * coordinates is the same as the local one.
+     */
+    Hit worldSurfaceAt(Ray &ray, const HitRecord &record) {
+        glm::vec3 worldCenter = translation + uniformScale * center;
+
+        Hit hit{};
+        hit.hit = true;
+        hit.intersection = ray.origin + record.t * ray.direction;
+        hit.distance = record.distance;
+        hit.object = this;
+        hit.material = material;
+
+        glm::vec3 newNormal = glm::normalize(hit.intersection - worldCenter);
+        hit.normal = newNormal;
+        hit.normalShading = newNormal;
+
+        hit.uv.s = (asin(newNormal.y) + M_PI / 2) / M_PI;
+        hit.uv.t = (atan2(newNormal.z, newNormal.x) + M_PI) / (2 * M_PI);
+
+        applyNormalMap(hit);
         return hit;
     }
+
+    // FEAT: NORMAL MAPS
+    void applyNormalMap(Hit &hit) {
+        if (getMaterial().hasNormalMap) {
+            glm::vec3 tangent = glm::normalize(glm::cross(glm::vec3(0.0f, 1.0f, 0.0f), hit.intersection));
+            glm::vec3 bitangent = glm::normalize(glm::cross(hit.normal, tangent));
+            hit.tangent = tangent;
+            hit.bitangent = bitangent;
+
+            glm::vec3 normal_map = glm::normalize(getMaterial().normalMap(hit.uv));
+
+            glm::mat3 TBN = glm::mat3(tangent, bitangent, hit.normal);
+
+            hit.normalShading = glm::normalize(TBN * normal_map);
+        }
+    }
 };
 
 /**
  * @brief Class representing a plane object.
  */
-class Plane : public Object {
+class Plane final : public Object {
 
 private:
     // Normal vector of the plane.
@@ -122,9 +272,9 @@ public:
      * @param point A point on the plane.
      * @param normal Normal vector of the plane.
      * @param hasMaterial If it has a material.
-     * @param material Material of the plane.
+     * @param material Index of the material of the plane in the material table.
      */
-    Plane(glm::vec3 point, glm::vec3 normal, bool hasMaterial, Material material = Material())
+    Plane(glm::vec3 point, glm::vec3 normal, bool hasMaterial, MaterialId material = 0)
             : point(point), normal(normal) {
         if (hasMaterial) {
             this->material = material;
@@ -133,11 +283,10 @@ public:
     /**
      * @brief Implementation of the intersection function for the plane.
      * @param ray The ray to check for intersection.
-     * @return The Hit structure representing the intersection.
+     * @return The HitRecord structure representing the intersection.
      */
-    Hit intersect(Ray &ray) override {
-        Hit hit{};
-        hit.hit = false;
+    HitRecord findHit(Ray &ray) override {
+        HitRecord hit;
 
         float ddotN = glm::dot(ray.direction, normal);
 
@@ -153,24 +302,39 @@ public:
             return hit;
         }
 
-        hit.intersection = ray.origin + t * ray.direction;
-        hit.normal = normal;
         hit.distance = t;
         hit.object = this;
+        return hit;
+    }
+
+    /**
+     * @brief Computes the surface of the plane at an intersection.
+     * @param ray The ray given to findHit.
+     * @param record The intersection returned by findHit.
+     * @return The Hit structure representing the intersection.
+     */
+    Hit surfaceAt(Ray &ray, const HitRecord &record) override {
+        Hit hit{};
+
+        hit.intersection = ray.origin + record.distance * ray.direction;
+        hit.normal = normal;
+        hit.distance = record.distance;
+        hit.object = this;
+        hit.material = material;
         hit.hit = true;
         hit.uv.x = 0.1f * hit.intersection.x;
         hit.uv.y = 0.1f * hit.intersection.z;
         hit.normalShading = normal;
 
         // FEAT: NORMAL MAPS
-        if (material.hasNormalMap) {
+        if (getMaterial().hasNormalMap) {
             glm::vec3 tangent = glm::vec3(0, 0, 1);
             glm::vec3 bitangent = glm::vec3(1, 0, 0);
 
             hit.tangent = tangent;
             hit.bitangent = bitangent;
 
-            glm::vec3 normal_map = glm::normalize(material.normalMap(hit.uv));
+            glm::vec3 normal_map = glm::normalize(getMaterial().normalMap(hit.uv));
 
             glm::mat3 TBN = glm::mat3(tangent, bitangent, hit.normal);
 
@@ -185,7 +349,7 @@ public:
 /**
  * @brief Class representing a cone object.
  */
-class Cone : public Object {
+class Cone final : public Object {
 private:
     // Base of the cone represented as a plane.
     Plane *base;
@@ -193,9 +357,9 @@ private:
 public:
     /**
      * @brief Constructor for the cone with a specified material.
-     * @param material Material of the cone.
+     * @param material Index of the material of the cone in the material table.
      */
-    explicit Cone(Material material) {
+    explicit Cone(MaterialId material) {
         this->material = material;
         base = new Plane(glm::vec3(0, 1, 0), glm::vec3(0, 1, 0), true, material);
     }
@@ -203,9 +367,33 @@ public:
     /**
      * @brief Implementation of the intersection function for the cone.
      * @param ray The ray to check for intersection.
+     * @return The HitRecord structure representing the intersection.
+     */
+    HitRecord findHit(Ray &ray) override {
+        HitRecord record;
+        Hit hit = coneIntersection(ray);
+        if (hit.hit) {
+            record.distance = hit.distance;
+            record.object = this;
+        }
+        return record;
+    }
+
+    /**
+     * @brief Computes the surface of the cone at an intersection found by findHit.
+     * @param ray The ray given to findHit.
      * @return The Hit structure representing the intersection.
      */
-    Hit intersect(Ray &ray) override {
+    Hit surfaceAt(Ray &ray, const HitRecord &) override {
+        // the side and the base of the cone are intersected again, rays rarely hit the cones
+        return coneIntersection(ray);
+    }
+
+private:
+    /**
+     * @brief Intersects the side and the base of the cone, computing the surface at the intersection.
+     */
+    Hit coneIntersection(Ray &ray) {
 
         Hit hit{};
         hit.hit = false;
@@ -257,6 +445,7 @@ public:
 
         hit.hit = true;
         hit.object = this;
+        hit.material = material;
 
         glm::vec3 newIntersectionGlobal =
                 glm::vec3(transformationMatrix * glm::vec4(newIntersection, 1.0));
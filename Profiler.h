@@ -0,0 +1,172 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+ * FEAT: TRACE PROFILER
+ * Scoped timers recording the phases of a run (texture and mesh loading,
+ * BVH construction, tiles, tone mapping and image writing) on a per-thread
+ * timeline, written with --trace as a Chrome trace that chrome://tracing or
+ * https://ui.perfetto.dev open.
+ *
+ * The textures are loaded by static initializers, before the command line is
+ * read, so the profiler records from the start of the program and main
+ * drops the events when no trace was asked for. Every thread appends to its
+ * own buffer, the buffers are only gathered when the trace is written.
+ **/
+
+/**
+ * @brief Recorder of the timed scopes of all the threads.
+ */
+class TraceProfiler {
+private:
+    struct Event {
+        std::string name;
+        std::string detail; ///< shown in the arguments of the event, may be empty
+        int64_t start, duration; ///< microseconds since the start of the program
+    };
+
+    struct ThreadBuffer {
+        int id;
+        std::vector<Event> events;
+    };
+
+    std::atomic<bool> recording{true};
+    std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+    std::mutex buffersMutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+
+    ThreadBuffer &threadBuffer() {
+        thread_local ThreadBuffer *buffer = nullptr;
+        if (buffer == nullptr) {
+            std::lock_guard<std::mutex> lock(buffersMutex);
+            buffers.emplace_back(new ThreadBuffer{(int) buffers.size(), {}});
+            buffer = buffers.back().get();
+        }
+        return *buffer;
+    }
+
+    static void writeEscaped(FILE *file, const std::string &text) {
+        for (char c: text) {
+            if (c == '"' || c == '\\') {
+                fputc('\\', file);
+            }
+            if ((unsigned char) c >= 0x20) {
+                fputc(c, file);
+            }
+        }
+    }
+
+public:
+    /**
+     * @brief The profiler of the program.
+     */
+    static TraceProfiler &get() {
+        static TraceProfiler profiler;
+        return profiler;
+    }
+
+    bool isRecording() const { return recording.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Stops recording and drops the events recorded so far.
+     */
+    void disable() {
+        recording = false;
+        std::lock_guard<std::mutex> lock(buffersMutex);
+        for (auto &buffer: buffers) {
+            buffer->events.clear();
+            buffer->events.shrink_to_fit();
+        }
+    }
+
+    /**
+     * @brief Microseconds since the start of the program.
+     */
+    int64_t now() const {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - epoch).count();
+    }
+
+    /**
+     * @brief Records a finished scope on the timeline of the calling thread.
+     */
+    void record(std::string name, std::string detail, int64_t start, int64_t end) {
+        threadBuffer().events.push_back(Event{std::move(name), std::move(detail), start, end - start});
+    }
+
+    /**
+     * @brief Writes the events in the Chrome trace format, the threads must be done recording.
+     * @return False if the file could not be written.
+     */
+    bool write(const std::string &path) {
+        FILE *file = fopen(path.c_str(), "w");
+        if (file == nullptr) {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(buffersMutex);
+        fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+        bool first = true;
+        for (const auto &buffer: buffers) {
+            fprintf(file, "%s{\"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"name\": \"thread_name\", "
+                          "\"args\": {\"name\": \"%s %d\"}}", first ? "" : ",\n", buffer->id,
+                    buffer->id == 0 ? "main" : "thread", buffer->id);
+            first = false;
+            for (const Event &event: buffer->events) {
+                fprintf(file, ",\n{\"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %lld, \"dur\": %lld, \"name\": \"",
+                        buffer->id, (long long) event.start, (long long) event.duration);
+                writeEscaped(file, event.name);
+                fprintf(file, "\"");
+                if (!event.detail.empty()) {
+                    fprintf(file, ", \"args\": {\"detail\": \"");
+                    writeEscaped(file, event.detail);
+                    fprintf(file, "\"}");
+                }
+                fprintf(file, "}");
+            }
+        }
+        fprintf(file, "\n]}\n");
+        return fclose(file) == 0;
+    }
+};
+
+/**
+ * @brief Timer recording the time between its construction and its destruction as an event.
+ */
+class TraceScope {
+private:
+    const char *name;
+    std::string detail;
+    int64_t start = -1; ///< -1 if the profiler was not recording
+
+public:
+    /**
+     * @param name Name of the event, must outlive the scope.
+     * @param detail Optional detail, such as the file being loaded.
+     */
+    explicit TraceScope(const char *name, std::string detail = std::string()) : name(name) {
+        TraceProfiler &profiler = TraceProfiler::get();
+        if (profiler.isRecording()) {
+            this->detail = std::move(detail);
+            start = profiler.now();
+        }
+    }
+
+    ~TraceScope() {
+        TraceProfiler &profiler = TraceProfiler::get();
+        if (start >= 0 && profiler.isRecording()) {
+            profiler.record(name, std::move(detail), start, profiler.now());
+        }
+    }
+
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+};
+
+#endif // PROFILER_H
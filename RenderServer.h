@@ -0,0 +1,216 @@
+#ifndef RENDERSERVER_H
+#define RENDERSERVER_H
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/*
+ * FEAT: RENDER SERVER
+ * A render server loads the scene once and then renders the requests it
+ * receives on a local UNIX socket, so that the scene loading (meshes, BVHs
+ * and textures) is paid once instead of for every image.
+ *
+ * Every connection carries one job. The client sends a single line of
+ * space separated key=value options, for instance
+ *     width=256 height=192 samples=4 origin=-0.45,-0.21,1.52 format=png
+ * and the server answers either "OK <size>\n" followed by the encoded
+ * image, "OK <path>\n" if the request gave an output=<path>, or
+ * "ERROR <message>\n". The line "shutdown" stops the server.
+ * Jobs are rendered one after the other, each one with all the threads.
+ **/
+
+/**
+ * @brief Options of a render request, by name.
+ */
+using RenderRequest = std::map<std::string, std::string>;
+
+/**
+ * @brief Function rendering a request into an image file.
+ * @return An empty string on success, otherwise the error sent back to the client.
+ */
+using RenderJobFunction = std::function<std::string(const RenderRequest &, const std::string &)>;
+
+/**
+ * @brief Class accepting render requests on a UNIX socket.
+ */
+class RenderServer {
+private:
+    std::string socketPath;
+    int listener = -1;
+
+    static bool sendAll(int socket, const void *data, size_t size) {
+        const char *bytes = static_cast<const char *>(data);
+        while (size > 0) {
+            const ssize_t n = send(socket, bytes, size, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                return false;
+            }
+            bytes += n;
+            size -= n;
+        }
+        return true;
+    }
+
+    static bool sendLine(int socket, const std::string &line) {
+        const std::string text = line + "\n";
+        return sendAll(socket, text.data(), text.size());
+    }
+
+    /**
+     * @brief Reads the request line of a connection.
+     */
+    static bool receiveLine(int socket, std::string &line) {
+        char c;
+        while (line.size() < 4096) {
+            const ssize_t n = recv(socket, &c, 1, 0);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                return !line.empty();
+            }
+            if (c == '\n') {
+                return true;
+            }
+            if (c != '\r') {
+                line += c;
+            }
+        }
+        return false;
+    }
+
+public:
+    /**
+     * @brief Splits a request line into its key=value options, an option without '=' gets an empty value.
+     */
+    static RenderRequest parseRequest(const std::string &line) {
+        RenderRequest request;
+        std::istringstream words(line);
+        std::string word;
+        while (words >> word) {
+            const size_t equal = word.find('=');
+            if (equal == std::string::npos) {
+                request[word] = "";
+            } else {
+                request[word.substr(0, equal)] = word.substr(equal + 1);
+            }
+        }
+        return request;
+    }
+
+    /**
+     * @brief Constructor for the server, listening on a UNIX socket.
+     * @param socketPath Path of the socket, an existing socket at that path is replaced.
+     */
+    explicit RenderServer(std::string socketPath) : socketPath(std::move(socketPath)) {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (this->socketPath.size() >= sizeof(address.sun_path)) {
+            return;
+        }
+        std::strcpy(address.sun_path, this->socketPath.c_str());
+        unlink(this->socketPath.c_str());
+        listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (bind(listener, (sockaddr *) &address, sizeof(address)) != 0 || listen(listener, 16) != 0) {
+            close(listener);
+            listener = -1;
+        }
+    }
+
+    ~RenderServer() {
+        if (listener >= 0) {
+            close(listener);
+            unlink(socketPath.c_str());
+        }
+    }
+
+    bool isListening() const { return listener >= 0; }
+
+    /**
+     * @brief Serves the requests until a shutdown request.
+     * @param render Function rendering a request into the given image file, whose extension
+     * gives the format.
+     */
+    void run(const RenderJobFunction &render) {
+        while (true) {
+            const int client = accept(listener, nullptr, nullptr);
+            if (client < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                perror("accept");
+                return;
+            }
+
+            std::string line;
+            if (!receiveLine(client, line)) {
+                close(client);
+                continue;
+            }
+            RenderRequest request = parseRequest(line);
+            if (request.count("shutdown")) {
+                sendLine(client, "OK shutdown");
+                close(client);
+                return;
+            }
+
+            // without an output path, the image goes through a temporary file and back to the client
+            const auto output = request.find("output");
+            std::string path;
+            if (output != request.end()) {
+                path = output->second;
+            } else {
+                const std::string format = request.count("format") ? request["format"] : "ppm";
+                if (format != "ppm" && format != "png" && format != "pfm" && format != "exr") {
+                    sendLine(client, "ERROR unknown format " + format);
+                    close(client);
+                    continue;
+                }
+                std::string name = "/tmp/raytracer-XXXXXX." + format;
+                const int file = mkstemps(&name[0], (int) format.size() + 1);
+                if (file < 0) {
+                    sendLine(client, "ERROR could not create a temporary file");
+                    close(client);
+                    continue;
+                }
+                ::close(file);
+                path = name;
+            }
+
+            const std::string error = render(request, path);
+            if (!error.empty()) {
+                sendLine(client, "ERROR " + error);
+            } else if (output != request.end()) {
+                sendLine(client, "OK " + path);
+            } else {
+                std::ifstream file(path, std::ios::binary);
+                const std::vector<char> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+                if (sendLine(client, "OK " + std::to_string(bytes.size()))) {
+                    sendAll(client, bytes.data(), bytes.size());
+                }
+            }
+            if (output == request.end()) {
+                unlink(path.c_str());
+            }
+            close(client);
+        }
+    }
+};
+
+#endif // RENDERSERVER_H
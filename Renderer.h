@@ -0,0 +1,429 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include "glm/geometric.hpp"
+#include "glm/glm.hpp"
+#include "glm/gtx/transform.hpp"
+#include "glm/trigonometric.hpp"
+#include "glm/gtx/vector_angle.hpp"
+
+#include <array>
+#include <cmath>
+#include <utility>
+#include <vector>
+#include <omp.h>
+
+#include "Objects.h"
+#include "MeshLoader.h"
+#include "Scene.h"
+#include "Stats.h"
+
+/*
+ * The scene (objects and lights) and the functions tracing and shading a
+ * ray through it, shared by the renderer in main.cpp and by the
+ * microbenchmarks in benchmark.cpp.
+ **/
+
+using namespace std;
+
+constexpr float EPSILON = 0.001f;
+
+/**
+ Light class
+ */
+class Light {
+public:
+    glm::vec3 position; ///< Position of the light source
+    glm::vec3 color;    ///< Color/intentisty of the light source
+    explicit Light(glm::vec3 position) : position(position), color(glm::vec3(1.0)) {}
+
+    Light(glm::vec3 position, glm::vec3 color)
+            : position(position), color(color) {}
+};
+
+vector<Light *> lights; ///< A list of lights in the scene
+glm::vec3 ambient_light(0.7);
+
+/**
+ The objects of the scene, stored by value in one array per type. The intersection loops go over every
+ array with the concrete type of its objects, whose classes are final, so the calls to findHit are direct
+ and can be inlined instead of going through the virtual table of each object.
+ */
+struct SceneObjects {
+    // the arrays are reserved before they are filled, the hits and the caches point into them
+    vector<MeshLoader> meshes;
+    vector<Plane> planes;
+    vector<Sphere> spheres;
+    vector<Cone> cones;
+
+    size_t size() const { return meshes.size() + planes.size() + spheres.size() + cones.size(); }
+
+    /**
+     Calls visitor with every object, the meshes first, then the planes, the spheres and the cones
+     @param visitor Function taking an object, returning true to stop the visit
+     @return True if the visitor stopped the visit
+     */
+    template<typename Visitor>
+    bool visit(Visitor &&visitor) {
+        return visitArray(meshes, visitor) || visitArray(planes, visitor) || visitArray(spheres, visitor) ||
+               visitArray(cones, visitor);
+    }
+
+private:
+    template<typename Type, typename Visitor>
+    static bool visitArray(vector<Type> &array, Visitor &visitor) {
+        for (Type &object: array) {
+            if (visitor(object)) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+SceneObjects objects; ///< All the objects in the scene
+
+
+/**
+ Per-thread cache remembering, for each light, the last object that blocked a shadow ray.
+ Neighbouring pixels and samples are usually shadowed by the same object, so it is tested
+ before traversing the whole scene.
+ */
+struct alignas(64) ShadowCache {
+    vector<Object *> lastOccluder; ///< Last occluder found for each light (nullptr if none)
+    long lookups = 0; ///< Number of shadow rays that went through the cache
+    long hits = 0;    ///< Number of shadow rays resolved by the cached occluder
+};
+
+vector<ShadowCache> shadowCaches; ///< One shadow cache per thread
+
+bool is_shadowed(glm::vec3 point, glm::vec3 normal, glm::vec3 direction,
+                 const float distance, const int lightIndex) {
+    // avoid sending shadow rays towards lights behind the surface
+    if (glm::dot(normal, direction) < 0) {
+        return true;
+    }
+
+    // origin of the shadow ray is moved a little to avoid self intersection
+    Ray shadowRay = Ray(point + EPSILON * direction, direction);
+    STATS(threadStats().shadowRays++);
+
+    ShadowCache &cache = shadowCaches[omp_get_thread_num()];
+    Object *&lastOccluder = cache.lastOccluder[lightIndex];
+    cache.lookups++;
+
+    if (lastOccluder != nullptr) {
+        HitRecord hit = lastOccluder->findHit(shadowRay);
+        STATS(threadStats().objectTests++; threadStats().objectHits += hit.hit());
+        if (hit.hit() && hit.distance <= distance) {
+            cache.hits++;
+            return true;
+        }
+    }
+
+    return objects.visit([&](auto &object) {
+        if (&object == lastOccluder) {
+            return false;
+        }
+        HitRecord hit = object.findHit(shadowRay);
+        STATS(threadStats().objectTests++; threadStats().objectHits += hit.hit());
+        if (hit.hit() && hit.distance <= distance) {
+            lastOccluder = &object;
+            return true;
+        }
+        return false;
+    });
+}
+
+/**
+ Finds the closest intersection of a ray with the objects of the scene. The objects only return the
+ distance of their intersections, the surface (normals, texture coordinates and normal maps) is
+ computed once, at the closest one.
+ */
+Hit closest(Ray ray) {
+    HitRecord closest_record;
+
+    objects.visit([&](auto &object) {
+        HitRecord record = object.findHit(ray);
+        STATS(threadStats().objectTests++; threadStats().objectHits += record.hit());
+        if (record.hit() && record.distance < closest_record.distance)
+            closest_record = record;
+        return false;
+    });
+
+    if (!closest_record.hit()) {
+        Hit closest_hit{};
+        closest_hit.hit = false;
+        closest_hit.distance = INFINITY;
+        return closest_hit;
+    }
+    return closest_record.object->surfaceAt(ray, closest_record);
+}
+
+glm::vec3 PhongModel(glm::vec3 point, glm::vec3 normal, glm::vec3 normalShading, glm::vec2 uv,
+                     glm::vec3 view_direction, const Material &material,
+                     const int maxBounces, const Hit &hit);
+
+/**
+ Shading kernel of the materials of one kind: the features missing from the kind are left out at compile time,
+ so that the loop over the lights does not test the material. See PhongModel for the parameters.
+ */
+template<unsigned Kind>
+glm::vec3 shadeMaterial(glm::vec3 point, glm::vec3 normal, glm::vec3 normalShading, glm::vec2 uv,
+                        glm::vec3 view_direction, const Material &material, const int maxBounces, const Hit &hit) {
+    glm::vec3 color(0.0);
+
+    // flip normal if it is pointing away from the view direction
+    if (glm::dot(normal, view_direction) < 0) {
+        normal = -normal;
+    }
+    // flip shading normal if it is pointing away from the view direction
+    if (glm::dot(normalShading, view_direction) < 0) {
+        normalShading = -normalShading;
+    }
+
+    // the same for all the lights
+    glm::vec3 diffuse_color;
+    if constexpr ((Kind & SHADE_TEXTURE) != 0) {
+        diffuse_color = material.texture(uv);
+    } else {
+        diffuse_color = material.diffuse;
+    }
+    float shiny = 0.0f;
+    if constexpr ((Kind & SHADE_ANISOTROPIC) != 0) {
+        // the Ward highlights do not use the shininess
+    } else if constexpr ((Kind & SHADE_IMAGE_TEXTURE) != 0) {
+        shiny = (0.5f / pow((material.roughness(uv)), 4)) - 0.5f;
+    } else {
+        shiny = material.shininess;
+    }
+
+    for (size_t lightIndex = 0; lightIndex < lights.size(); lightIndex++) {
+        Light *light = lights[lightIndex];
+        glm::vec3 light_direction = glm::normalize(light->position - point);
+        const float distance_from_light = glm::distance(point, light->position);
+
+        if (!is_shadowed(point, normal, light_direction, distance_from_light, lightIndex)) {
+
+            const float diffuse = max(0.0f, glm::dot(light_direction, normalShading));
+
+            glm::vec3 h =
+                    glm::normalize(light_direction + view_direction); // half vector
+
+            const float distance = max(0.1f, distance_from_light);
+            const float attenuation = 1.0f / glm::pow(distance, 2);
+            glm::vec3 diffusion = attenuation * light->color * diffuse_color * diffuse;
+
+            glm::vec3 specular_term = glm::vec3(0.0f); // Initialize to zero
+
+            // FEAT: SPECULAR HIGHLIGHTS
+            if constexpr ((Kind & SHADE_ANISOTROPIC) != 0) {
+                // https://en.wikipedia.org/wiki/Specular_highlight#Ward_anisotropic_distribution
+
+                float NdotL = glm::dot(normalShading, light_direction);
+                float NdotV = glm::dot(normalShading, view_direction);
+
+                if (NdotL > 0 && NdotV > 0) {
+                    float HdotTangent = glm::dot(h, hit.tangent);
+                    float HdotBitangent = glm::dot(h, hit.bitangent);
+                    float HdotN = glm::dot(h, normalShading);
+
+                    float exponent = -2.0f * (glm::pow((HdotTangent / material.alpha_x), 2.0f)
+                                              * glm::pow((HdotBitangent / material.alpha_y), 2.0f)) / (1 + HdotN);
+
+                    specular_term = (material.specular * NdotL * exp(exponent)) /
+                                    (sqrt(NdotL * NdotV) * 4 * glm::pi<float>() * material.alpha_x * material.alpha_y);
+                }
+            } else {
+                const float specular = max(0.0f, glm::pow(glm::dot(h, normalShading), 4 * shiny));
+                specular_term = attenuation * light->color * material.specular * specular;
+            }
+
+            color += diffusion + specular_term;
+        }
+    }
+    if constexpr ((Kind & (SHADE_REFLECTION | SHADE_REFRACTION)) != 0) {
+        if (maxBounces > 0) {
+
+            glm::vec3 reflection(0.0f);
+
+            if constexpr ((Kind & SHADE_REFLECTION) != 0) {
+                color *= 1 - material.reflection;
+                glm::vec3 reflection_direction = glm::reflect(-view_direction, normalShading);
+                glm::vec3 reflection_position = point + EPSILON * reflection_direction;
+                Ray reflection_ray = Ray(reflection_position, reflection_direction);
+                STATS(threadStats().reflectionRays++);
+
+                Hit closest_hit = closest(reflection_ray);
+
+                if (closest_hit.hit) {
+                    reflection =
+                            material.reflection *
+                            PhongModel(closest_hit.intersection, closest_hit.normal, closest_hit.normalShading,
+                                       closest_hit.uv, glm::normalize(-reflection_direction),
+                                       materialTable[closest_hit.material], maxBounces - 1, closest_hit);
+                }
+            }
+
+            glm::vec3 refraction(0.0f);
+
+            if constexpr ((Kind & SHADE_REFRACTION) != 0) {
+                color *= (1 - material.refraction);
+                const bool is_entering = glm::dot(normalShading, -view_direction) < 0.0f;
+
+                const float n1 = is_entering ? 1.0f : material.sigma;
+                const float n2 = is_entering ? material.sigma : 1.0f;
+                const float eta = n1 / n2;
+
+                glm::vec3 refraction_direction =
+                        glm::refract(-view_direction, is_entering ? normalShading : -normalShading, eta);
+
+                // on total internal reflection refract returns a zero vector, there is no refraction ray
+                if (refraction_direction != glm::vec3(0.0f)) {
+                    glm::vec3 refraction_position = point + EPSILON * refraction_direction;
+
+                    Ray refraction_ray = Ray(refraction_position, refraction_direction);
+                    STATS(threadStats().refractionRays++);
+
+                    Hit closest_hit = closest(refraction_ray);
+
+                    if (closest_hit.hit) {
+                        refraction =
+                                material.refraction *
+                                PhongModel(closest_hit.intersection, closest_hit.normal, closest_hit.normalShading,
+                                           closest_hit.uv, glm::normalize(-refraction_direction),
+                                           materialTable[closest_hit.material], maxBounces - 1, closest_hit);
+
+                        float O1 = cos(glm::angle(normalShading, view_direction));
+                        float O2 = cos(glm::angle(-normalShading, refraction_direction));
+
+                        float R = 0.5f * (pow((n1 * O1 - n2 * O2) / (n1 * O1 + n2 * O2), 2) +
+                                          pow((n1 * O2 - n2 * O1) / (n1 * O2 + n2 * O1), 2));
+                        float T = 1 - R;
+
+                        reflection *= R;
+                        refraction *= T;
+                    }
+                }
+            }
+            color += reflection + refraction;
+        }
+    }
+    if constexpr ((Kind & SHADE_IMAGE_TEXTURE) != 0) {
+        color += ambient_light * 0.1f * material.occlusion(uv);
+    } else {
+        color += ambient_light * material.ambient;
+    }
+    return color;
+}
+
+using ShadingKernel = glm::vec3 (*)(glm::vec3, glm::vec3, glm::vec3, glm::vec2, glm::vec3, const Material &,
+                                    const int, const Hit &);
+
+template<unsigned... Kinds>
+constexpr array<ShadingKernel, sizeof...(Kinds)> makeShadingKernels(integer_sequence<unsigned, Kinds...>) {
+    return {&shadeMaterial<Kinds>...};
+}
+
+/**
+ The shading kernels, indexed by the kind of the material
+ */
+constexpr array<ShadingKernel, SHADING_KINDS> shadingKernels =
+        makeShadingKernels(make_integer_sequence<unsigned, SHADING_KINDS>());
+
+/** Function for computing color of an object according to the Phong Model
+ @param point A point belonging to the object for which the color is computer
+ @param normal A normal vector the the point
+ @param uv Texture coordinates
+ @param view_direction A normalized direction from the point to the
+ viewer/camera
+ @param material A material structure representing the material of the object
+*/
+glm::vec3 PhongModel(glm::vec3 point, glm::vec3 normal, glm::vec3 normalShading, glm::vec2 uv,
+                     glm::vec3 view_direction, const Material &material,
+                     const int maxBounces, const Hit &hit) {
+    STATS(threadStats().shadingCalls[hit.material]++);
+    // the kind was computed when the material was added, the kernels do not test the material again
+    return shadingKernels[materialKinds[hit.material]](point, normal, normalShading, uv, view_direction, material,
+                                                       maxBounces, hit);
+}
+
+/**
+ Functions that computes a color along the ray
+ @param ray Ray that should be traced through the scene
+ @param bounces number of bounces
+ @return Color at the intersection point
+ */
+glm::vec3 trace_ray(Ray ray, int bounces) {
+    STATS(threadStats().primaryRays++);
+    Hit closest_hit = closest(ray);
+
+    glm::vec3 color(0.0);
+
+    if (closest_hit.hit) {
+        color = PhongModel(closest_hit.intersection, closest_hit.normal, closest_hit.normalShading,
+                           closest_hit.uv, glm::normalize(-ray.direction),
+                           materialTable[closest_hit.material], bounces, closest_hit);
+    }
+    // clamp the final color to [0,1]
+    return glm::clamp(color, glm::vec3(0.0), glm::vec3(1.0));
+}
+
+/**
+ Function performing tonemapping of the intensities computed using the raytracer
+ @param intensity Input intensity
+ @return Tonemapped intensity in range (0,1)
+ */
+glm::vec3 toneMapping(glm::vec3 intensity) {
+
+    float alpha = 1.5f;
+    float beta = 1.8f;
+    float gamma = 2.2f;
+    float oneOverGamma = 1.0f / gamma;
+
+    glm::vec3 new_intensity;
+
+    new_intensity.x = pow(alpha * pow(intensity.x, beta), oneOverGamma);
+    new_intensity.y = pow(alpha * pow(intensity.y, beta), oneOverGamma);
+    new_intensity.z = pow(alpha * pow(intensity.z, beta), oneOverGamma);
+
+    glm::vec3 tonemapped =
+            min(new_intensity, glm::vec3(1.0)); // tonemapped intensity
+    return glm::clamp(tonemapped, glm::vec3(0.0), glm::vec3(1.0));
+}
+
+/**
+ FEAT: SCENE FILES
+ Creates the objects and the lights of a scene, the meshes first, then the planes and the spheres
+ @param scene Description of the scene, the triangles of its parsed meshes are released once the meshes are built
+ */
+void buildScene(SceneDescription &scene) {
+    vector<MaterialId> materials;
+    for (size_t i = 0; i < scene.materials.size(); i++) {
+        materials.push_back(addMaterial(scene.materials[i], scene.materialNames[i]));
+    }
+    objects.meshes.reserve(scene.meshes.size());
+    objects.planes.reserve(scene.planes.size());
+    objects.spheres.reserve(scene.spheres.size());
+    for (SceneDescription::Mesh &mesh: scene.meshes) {
+        const MaterialId material = materials[mesh.material];
+        if (mesh.parsed) {
+            objects.meshes.emplace_back(mesh.triangles, mesh.minBounds, mesh.maxBounds, true, material);
+            vector<TriangleCorners>().swap(mesh.triangles);
+        } else {
+            objects.meshes.emplace_back(mesh.path, mesh.offset, true, material);
+        }
+    }
+    for (const SceneDescription::Plane &plane: scene.planes) {
+        objects.planes.emplace_back(plane.point, plane.normal, true, materials[plane.material]);
+    }
+    for (const SceneDescription::Sphere &sphere: scene.spheres) {
+        objects.spheres.emplace_back(materials[sphere.material]);
+        objects.spheres.back().setTransformation(glm::translate(sphere.center) * glm::scale(sphere.scale));
+    }
+    for (const SceneDescription::Light &light: scene.lights) {
+        lights.push_back(new Light(light.position, light.intensity));
+    }
+}
+
+#endif // RENDERER_H
@@ -0,0 +1,322 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+/*
+ * FEAT: SAMPLE PATTERNS
+ * The sub-pixel positions of the SSAA samples are generated by a Sampler.
+ * Every pattern precomputes a table of sample positions when the sampler is
+ * created, and decorrelates neighbouring pixels with a cheap per-pixel
+ * scramble so that the same table can be reused for the whole image.
+ *
+ * All patterns return offsets from the centre of the pixel. Apart from the
+ * original jitter matrix, whose samples reach 3/4 of a pixel away from the
+ * centre, the offsets are in [-0.5, 0.5).
+ **/
+
+/**
+ * @brief Patterns available for placing the samples inside a pixel.
+ */
+enum class SamplePattern {
+    Jitter4,    ///< The original hand-made 4 samples jitter matrix
+    Stratified, ///< One random sample in each cell of a regular grid
+    R2,         ///< Additive recurrence based on the plastic number
+    Sobol,      ///< Owen scrambled (0,2)-sequence
+    BlueNoise   ///< R2 samples shifted by a tiled blue-noise mask
+};
+
+/**
+ * @brief Parses the name of a sample pattern.
+ * @param name Name of the pattern (jitter4, stratified, r2, sobol or bluenoise).
+ * @param pattern Pattern written when the name is valid.
+ * @return True if the name is valid.
+ */
+inline bool parseSamplePattern(const std::string &name, SamplePattern &pattern) {
+    if (name == "jitter4") {
+        pattern = SamplePattern::Jitter4;
+    } else if (name == "stratified") {
+        pattern = SamplePattern::Stratified;
+    } else if (name == "r2") {
+        pattern = SamplePattern::R2;
+    } else if (name == "sobol") {
+        pattern = SamplePattern::Sobol;
+    } else if (name == "bluenoise") {
+        pattern = SamplePattern::BlueNoise;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Name of a sample pattern, as accepted by parseSamplePattern.
+ */
+inline const char *samplePatternName(SamplePattern pattern) {
+    switch (pattern) {
+        case SamplePattern::Jitter4:
+            return "jitter4";
+        case SamplePattern::Stratified:
+            return "stratified";
+        case SamplePattern::R2:
+            return "r2";
+        case SamplePattern::Sobol:
+            return "sobol";
+        case SamplePattern::BlueNoise:
+            return "bluenoise";
+    }
+    return "unknown";
+}
+
+/**
+ * @brief Class generating the positions of the samples inside the pixels.
+ */
+class Sampler {
+private:
+    // Pattern used to place the samples.
+    SamplePattern pattern;
+
+    // Number of samples per pixel.
+    int samplesPerPixel;
+
+    // Sample positions in [0, 1)^2 shared by all pixels, for the floating point patterns.
+    std::vector<glm::vec2> table;
+
+    // Sample positions as 32 bit fixed point fractions, for the Sobol pattern.
+    std::vector<glm::uvec2> sobolTable;
+
+    // Size of the tiled blue-noise mask.
+    static const int blueNoiseSize = 64;
+
+    // Blue-noise mask with two decorrelated channels, values in [0, 1).
+    std::vector<glm::vec2> blueNoise;
+
+    /**
+     * @brief Hashes the pixel coordinates and a seed into 32 well mixed bits.
+     */
+    static uint32_t hash(uint32_t x, uint32_t y, uint32_t seed) {
+        uint32_t h = x * 0x8da6b343u ^ y * 0xd8163841u ^ seed * 0xcb1ab31fu;
+        h ^= h >> 16;
+        h *= 0x7feb352du;
+        h ^= h >> 15;
+        h *= 0x846ca68bu;
+        h ^= h >> 16;
+        return h;
+    }
+
+    static uint32_t reverseBits(uint32_t x) {
+        x = (x << 16) | (x >> 16);
+        x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+        x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+        x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+        x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+        return x;
+    }
+
+    /**
+     * @brief Owen scrambling of a 32 bit fraction, using the hash based permutation by Laine and Karras.
+     * https://psychopath.io/post/2021_01_30_building_a_better_lk_hash
+     */
+    static uint32_t owenScramble(uint32_t x, uint32_t seed) {
+        x = reverseBits(x);
+        x ^= x * 0x3d20adeau;
+        x += seed;
+        x *= (seed >> 16) | 1u;
+        x ^= x * 0x05526c56u;
+        x ^= x * 0x53a22864u;
+        return reverseBits(x);
+    }
+
+    static float toUnitFloat(uint32_t x) {
+        // keep 24 bits so that the result is strictly below 1
+        return (float) (x >> 8) * (1.0f / 16777216.0f);
+    }
+
+    void buildStratified() {
+        const int cells = (int) std::ceil(std::sqrt((float) samplesPerPixel));
+        std::mt19937 rng(1);
+        std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+
+        std::vector<int> order(cells * cells);
+        for (size_t i = 0; i < order.size(); i++) {
+            order[i] = (int) i;
+        }
+        // shuffle the cells so that the first samples of a pixel are spread over it as well
+        std::shuffle(order.begin(), order.end(), rng);
+
+        for (int i = 0; i < samplesPerPixel; i++) {
+            const int cell = order[i];
+            table.emplace_back((cell % cells + uniform(rng)) / cells, (cell / cells + uniform(rng)) / cells);
+        }
+    }
+
+    void buildR2() {
+        // https://extremelearning.com.au/unreasonable-effectiveness-of-quasirandom-sequences/
+        const double g = 1.32471795724474602596;
+        const double a1 = 1.0 / g;
+        const double a2 = 1.0 / (g * g);
+        for (int i = 0; i < samplesPerPixel; i++) {
+            table.emplace_back((float) std::fmod(0.5 + a1 * i, 1.0), (float) std::fmod(0.5 + a2 * i, 1.0));
+        }
+    }
+
+    void buildSobol() {
+        // first dimension is the van der Corput sequence, the second one uses the
+        // direction numbers of the primitive polynomial x + 1
+        uint32_t directions[32];
+        directions[0] = 1u << 31;
+        for (int i = 1; i < 32; i++) {
+            directions[i] = directions[i - 1] ^ (directions[i - 1] >> 1);
+        }
+        for (uint32_t i = 0; i < (uint32_t) samplesPerPixel; i++) {
+            uint32_t y = 0;
+            for (int bit = 0; bit < 32; bit++) {
+                if (i & (1u << bit)) {
+                    y ^= directions[bit];
+                }
+            }
+            sobolTable.emplace_back(reverseBits(i), y);
+        }
+    }
+
+    /**
+     * @brief Builds the blue-noise mask by repeatedly placing the next rank in the
+     * emptiest spot of the tile, which is a simplified void-and-cluster method.
+     */
+    void buildBlueNoise() {
+        const int n = blueNoiseSize * blueNoiseSize;
+        const float sigma = 1.5f;
+
+        // energy contribution of a point, indexed by the toroidal offset
+        std::vector<float> kernel(n);
+        for (int dy = 0; dy < blueNoiseSize; dy++) {
+            for (int dx = 0; dx < blueNoiseSize; dx++) {
+                const int wx = std::min(dx, blueNoiseSize - dx);
+                const int wy = std::min(dy, blueNoiseSize - dy);
+                kernel[dy * blueNoiseSize + dx] = std::exp(-(float) (wx * wx + wy * wy) / (2 * sigma * sigma));
+            }
+        }
+
+        blueNoise.assign(n, glm::vec2(0.0f));
+        for (int channel = 0; channel < 2; channel++) {
+            // a tiny random initial energy breaks the ties differently in the two channels,
+            // otherwise the second channel would be a shifted copy of the first one
+            std::mt19937 rng(channel + 1);
+            std::uniform_real_distribution<float> tieBreak(0.0f, 1e-4f);
+            std::vector<float> energy(n);
+            for (float &e: energy) {
+                e = tieBreak(rng);
+            }
+            std::vector<bool> taken(n, false);
+            int next = (int) (std::min_element(energy.begin(), energy.end()) - energy.begin());
+
+            for (int rank = 0; rank < n; rank++) {
+                taken[next] = true;
+                blueNoise[next][channel] = (rank + 0.5f) / n;
+
+                const int px = next % blueNoiseSize;
+                const int py = next / blueNoiseSize;
+                int best = -1;
+                for (int y = 0; y < blueNoiseSize; y++) {
+                    const int dy = (y - py + blueNoiseSize) % blueNoiseSize;
+                    for (int x = 0; x < blueNoiseSize; x++) {
+                        const int dx = (x - px + blueNoiseSize) % blueNoiseSize;
+                        const int i = y * blueNoiseSize + x;
+                        energy[i] += kernel[dy * blueNoiseSize + dx];
+                        if (!taken[i] && (best < 0 || energy[i] < energy[best])) {
+                            best = i;
+                        }
+                    }
+                }
+                next = best;
+            }
+        }
+    }
+
+public:
+    /**
+     * @brief Constructor for the sampler, precomputing the sample table.
+     * @param pattern Pattern used to place the samples.
+     * @param samplesPerPixel Number of samples per pixel.
+     */
+    Sampler(SamplePattern pattern, int samplesPerPixel) : pattern(pattern), samplesPerPixel(samplesPerPixel) {
+        if (pattern == SamplePattern::Jitter4 && samplesPerPixel > 4) {
+            std::cout << "The jitter4 pattern has only 4 samples per pixel" << std::endl;
+            this->samplesPerPixel = 4;
+        }
+
+        switch (pattern) {
+            case SamplePattern::Jitter4:
+                //FEAT: SUPER SAMPLING ANTI ALIASING (SSAA)
+                table = {
+                        {-1.0 / 4.0, 3.0 / 4.0},
+                        {3.0 / 4.0,  1.0 / 3.0},
+                        {-3.0 / 4.0, -1.0 / 4.0},
+                        {1.0 / 4.0,  -3.0 / 4.0},
+                };
+                break;
+            case SamplePattern::Stratified:
+                buildStratified();
+                break;
+            case SamplePattern::R2:
+                buildR2();
+                break;
+            case SamplePattern::Sobol:
+                buildSobol();
+                break;
+            case SamplePattern::BlueNoise:
+                buildR2();
+                buildBlueNoise();
+                break;
+        }
+    }
+
+    /**
+     * @brief Gets the number of samples per pixel.
+     */
+    int getSamplesPerPixel() const { return samplesPerPixel; }
+
+    /**
+     * @brief Gets the pattern used to place the samples.
+     */
+    SamplePattern getPattern() const { return pattern; }
+
+    /**
+     * @brief Computes the position of a sample inside a pixel.
+     * @param x x coordinate of the pixel.
+     * @param y y coordinate of the pixel.
+     * @param index Index of the sample, in [0, samplesPerPixel).
+     * @return Offset of the sample from the centre of the pixel, in pixels.
+     */
+    glm::vec2 sample(int x, int y, int index) const {
+        switch (pattern) {
+            case SamplePattern::Jitter4:
+                // the original pattern is the same for every pixel
+                return table[index];
+            case SamplePattern::Sobol: {
+                const glm::uvec2 &point = sobolTable[index];
+                return glm::vec2(toUnitFloat(owenScramble(point.x, hash(x, y, 0))),
+                                 toUnitFloat(owenScramble(point.y, hash(x, y, 1)))) - 0.5f;
+            }
+            case SamplePattern::BlueNoise: {
+                const glm::vec2 &shift = blueNoise[(y % blueNoiseSize) * blueNoiseSize + x % blueNoiseSize];
+                return glm::fract(table[index] + shift) - 0.5f;
+            }
+            default: {
+                // toroidal shift of the shared table, different for every pixel
+                const glm::vec2 shift(toUnitFloat(hash(x, y, 0)), toUnitFloat(hash(x, y, 1)));
+                return glm::fract(table[index] + shift) - 0.5f;
+            }
+        }
+    }
+};
+
+#endif // SAMPLER_H
@@ -0,0 +1,718 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <initializer_list>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "glm/glm.hpp"
+#include "Camera.h"
+#include "Material.h"
+#include "MeshLoader.h"
+#include "Textures.h"
+
+/*
+ * FEAT: SCENE FILES
+ * The scenes are described by text files loaded at runtime, so that a shot
+ * can be changed without recompiling. Every line starts with a keyword,
+ * followed by name/value pairs; '#' starts a comment:
+ *     resolution 1024 768
+ *     samples 4
+ *     camera origin -0.45 -0.21 1.52 tilt -0.75 0.4 fov 90 forward -1
+ *     material crystal ambient 0.1 0.2 0.3 refraction 1 reflection 0.5 sigma 2.4
+ *     mesh ./meshes/crystal_big_uv.obj crystal offset -0.34 -0.388 0.77
+ *     plane crystal point 0 -0.6 14.995 normal 0 1 0
+ *     sphere crystal center 0 -2.5 5.5 scale 0.5
+ *     light position 0 26 5 intensity 130
+ * A color or a scale can be given as one value or as three.
+ *
+ * The textures are C++ functions, which the files refer to by name through
+ * the registry below.
+ *
+ * A scene can also be compiled to a binary file, in which the materials
+ * refer to the textures by their index in the registry and the meshes are
+ * stored as already parsed and translated triangles, so that loading it
+ * skips the parsing of the .obj files. Binary scenes are recognised by
+ * their magic number, whatever the extension.
+ **/
+
+/**
+ * @brief Texture function of the registry, usable as a texture or a normal map.
+ */
+struct TextureFunction {
+    const char *name;
+    glm::vec3 (*function)(glm::vec2 uv);
+};
+
+/**
+ * @brief Scalar texture function of the registry, usable as a roughness or an occlusion map.
+ */
+struct ScalarTextureFunction {
+    const char *name;
+    float_t (*function)(glm::vec2 uv);
+};
+
+// the indices are stored in the compiled scenes, new functions go at the end
+static const TextureFunction textureFunctions[] = {
+        {"colorAt",          &colorAt},
+        {"normalAt",         &normalAt},
+        {"perlinNormal",     &perlinNormal},
+        {"perlinWater",      &perlinWater},
+        {"opal",             &opal},
+        {"perlinTerrain",    &perlinTerrain},
+        {"perlinIceTerrain", &perlinIceTerrain},
+        {"snowTerrain",      &snowTerrain},
+        {"qwilfishTexture",  &qwilfishTexture},
+};
+
+static const ScalarTextureFunction scalarTextureFunctions[] = {
+        {"roughnessAt",        &roughnessAt},
+        {"ambientOcclusionAt", &ambientOcclusionAt},
+};
+
+/**
+ * @brief Finds the index of a function in a registry by name or by address.
+ * @return The index, -1 if the function is not in the registry.
+ */
+template<typename Entry, size_t N, typename Match>
+int findTextureFunction(const Entry (&registry)[N], Match match) {
+    for (size_t i = 0; i < N; i++) {
+        if (match(registry[i])) {
+            return (int) i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Description of a scene, from which the objects and the lights are created.
+ */
+struct SceneDescription {
+    struct Mesh {
+        std::string path;
+        glm::vec3 offset = glm::vec3(0.0f);
+        int material = 0;
+        // filled when the scene is compiled, or read from a compiled scene
+        bool parsed = false;
+        std::vector<TriangleCorners> triangles;
+        glm::vec3 minBounds = glm::vec3(INFINITY), maxBounds = glm::vec3(-INFINITY);
+    };
+
+    struct Plane {
+        glm::vec3 point = glm::vec3(0.0f);
+        glm::vec3 normal = glm::vec3(0.0f, 1.0f, 0.0f);
+        int material = 0;
+    };
+
+    struct Sphere {
+        glm::vec3 center = glm::vec3(0.0f);
+        glm::vec3 scale = glm::vec3(1.0f);
+        int material = 0;
+    };
+
+    struct Light {
+        glm::vec3 position = glm::vec3(0.0f);
+        glm::vec3 intensity = glm::vec3(1.0f);
+    };
+
+    // 0 when the file does not set them, the command line values are then kept
+    int width = 0, height = 0;
+    int samples = 0;
+    Camera camera; // the default camera sits at the origin and looks towards +z
+
+    std::vector<std::string> materialNames;
+    std::vector<Material> materials;
+    std::vector<Mesh> meshes;
+    std::vector<Plane> planes;
+    std::vector<Sphere> spheres;
+    std::vector<Light> lights;
+
+    /**
+     * @brief Parses the .obj files of the meshes that are not parsed yet. A mesh whose file cannot
+     * be read stays unparsed, and is looked for again when the scene is built.
+     */
+    void parseMeshes() {
+        for (Mesh &mesh: meshes) {
+            if (!mesh.parsed) {
+                mesh.parsed = MeshLoader::readObj(mesh.path, mesh.offset, mesh.triangles, mesh.minBounds,
+                                                  mesh.maxBounds);
+            }
+        }
+    }
+};
+
+/**
+ * @brief Reads a scene file written in the text format.
+ */
+class SceneParser {
+private:
+    std::string path;
+    int lineNumber = 0;
+    std::vector<std::string> words;
+    size_t next = 0;
+    SceneDescription &scene;
+
+    bool error(const std::string &message) const {
+        std::cout << path << ":" << lineNumber << ": " << message << std::endl;
+        return false;
+    }
+
+    bool isNumber(size_t k) const {
+        if (k >= words.size()) {
+            return false;
+        }
+        char *end;
+        std::strtod(words[k].c_str(), &end);
+        return *end == '\0' && end != words[k].c_str();
+    }
+
+    // the values are read as doubles and then rounded, like the literals of the C++ scenes
+    bool readFloat(float &value) {
+        if (!isNumber(next)) {
+            return false;
+        }
+        value = (float) std::strtod(words[next++].c_str(), nullptr);
+        return true;
+    }
+
+    bool readInt(int &value) {
+        if (!isNumber(next)) {
+            return false;
+        }
+        value = std::atoi(words[next++].c_str());
+        return true;
+    }
+
+    bool readVec3(glm::vec3 &value, bool allowScalar) {
+        if (allowScalar && !isNumber(next + 1)) {
+            float scalar;
+            if (!readFloat(scalar)) {
+                return false;
+            }
+            value = glm::vec3(scalar);
+            return true;
+        }
+        return readFloat(value.x) && readFloat(value.y) && readFloat(value.z);
+    }
+
+    bool readWord(std::string &value) {
+        if (next >= words.size()) {
+            return false;
+        }
+        value = words[next++];
+        return true;
+    }
+
+    bool readMaterial(int &material) {
+        std::string name;
+        if (!readWord(name)) {
+            return error("missing material name");
+        }
+        for (size_t i = 0; i < scene.materialNames.size(); i++) {
+            if (scene.materialNames[i] == name) {
+                material = (int) i;
+                return true;
+            }
+        }
+        return error("unknown material " + name);
+    }
+
+    bool parseMaterial() {
+        std::string name;
+        if (!readWord(name)) {
+            return error("missing material name");
+        }
+        Material material;
+        std::string key;
+        while (readWord(key)) {
+            bool valid;
+            if (key == "ambient") {
+                valid = readVec3(material.ambient, true);
+            } else if (key == "diffuse") {
+                valid = readVec3(material.diffuse, true);
+            } else if (key == "specular") {
+                valid = readVec3(material.specular, true);
+            } else if (key == "reflection") {
+                valid = readFloat(material.reflection);
+            } else if (key == "refraction") {
+                valid = readFloat(material.refraction);
+            } else if (key == "sigma") {
+                valid = readFloat(material.sigma);
+            } else if (key == "shininess") {
+                valid = readFloat(material.shininess);
+            } else if (key == "anisotropic") {
+                material.isAnisotropic = true;
+                valid = readFloat(material.alpha_x) && readFloat(material.alpha_y);
+            } else if (key == "texture" || key == "normalMap") {
+                std::string function;
+                const int index = readWord(function) ? findTextureFunction(
+                        textureFunctions, [&](const TextureFunction &f) { return function == f.name; }) : -1;
+                if (index < 0) {
+                    return error("unknown texture function " + function);
+                }
+                if (key == "texture") {
+                    material.texture = textureFunctions[index].function;
+                } else {
+                    material.hasNormalMap = true;
+                    material.normalMap = textureFunctions[index].function;
+                }
+                valid = true;
+            } else if (key == "roughness" || key == "occlusion") {
+                std::string function;
+                const int index = readWord(function) ? findTextureFunction(
+                        scalarTextureFunctions, [&](const ScalarTextureFunction &f) { return function == f.name; })
+                                                     : -1;
+                if (index < 0) {
+                    return error("unknown texture function " + function);
+                }
+                (key == "roughness" ? material.roughness : material.occlusion) = scalarTextureFunctions[index].function;
+                valid = true;
+            } else if (key == "imageTexture") {
+                material.hasImgTexture = true;
+                valid = true;
+            } else {
+                return error("unknown material property " + key);
+            }
+            if (!valid) {
+                return error("invalid value for " + key);
+            }
+        }
+        if (material.hasImgTexture && (material.roughness == nullptr || material.occlusion == nullptr)) {
+            return error("imageTexture needs a roughness and an occlusion function");
+        }
+        for (const std::string &existing: scene.materialNames) {
+            if (existing == name) {
+                return error("material " + name + " is defined twice");
+            }
+        }
+        scene.materialNames.push_back(name);
+        scene.materials.push_back(material);
+        return true;
+    }
+
+    bool parseCamera() {
+        std::string key;
+        while (readWord(key)) {
+            bool valid;
+            if (key == "origin") {
+                valid = readVec3(scene.camera.origin, false);
+            } else if (key == "tilt") {
+                valid = readFloat(scene.camera.xTiltAngle) && readFloat(scene.camera.yTiltAngle);
+            } else if (key == "fov") {
+                valid = readFloat(scene.camera.fov);
+            } else if (key == "forward") {
+                valid = readFloat(scene.camera.forward);
+            } else {
+                return error("unknown camera property " + key);
+            }
+            if (!valid) {
+                return error("invalid value for " + key);
+            }
+        }
+        return true;
+    }
+
+    /**
+     * @brief Vector property of an object or a light.
+     */
+    struct Property {
+        const char *name;
+        glm::vec3 *value;
+        bool allowScalar; // the property can be given as a single value
+    };
+
+    /**
+     * @brief Parses the name/value pairs of an object or a light.
+     */
+    bool parseProperties(std::initializer_list<Property> properties) {
+        std::string key;
+        while (readWord(key)) {
+            bool found = false;
+            for (const Property &property: properties) {
+                if (key == property.name) {
+                    if (!readVec3(*property.value, property.allowScalar)) {
+                        return error("invalid value for " + key);
+                    }
+                    found = true;
+                }
+            }
+            if (!found) {
+                return error("unknown property " + key);
+            }
+        }
+        return true;
+    }
+
+    bool parseLine(const std::string &keyword) {
+        if (keyword == "resolution") {
+            if (!readInt(scene.width) || !readInt(scene.height) || scene.width < 1 || scene.height < 1) {
+                return error("invalid resolution");
+            }
+        } else if (keyword == "samples") {
+            if (!readInt(scene.samples) || scene.samples < 1) {
+                return error("invalid number of samples");
+            }
+        } else if (keyword == "camera") {
+            return parseCamera();
+        } else if (keyword == "material") {
+            return parseMaterial();
+        } else if (keyword == "mesh") {
+            SceneDescription::Mesh mesh;
+            if (!readWord(mesh.path)) {
+                return error("missing mesh path");
+            }
+            if (!readMaterial(mesh.material) || !parseProperties({{"offset", &mesh.offset, false}})) {
+                return false;
+            }
+            scene.meshes.push_back(mesh);
+        } else if (keyword == "plane") {
+            SceneDescription::Plane plane;
+            if (!readMaterial(plane.material) ||
+                !parseProperties({{"point", &plane.point, false}, {"normal", &plane.normal, false}})) {
+                return false;
+            }
+            scene.planes.push_back(plane);
+        } else if (keyword == "sphere") {
+            SceneDescription::Sphere sphere;
+            if (!readMaterial(sphere.material) ||
+                !parseProperties({{"center", &sphere.center, false}, {"scale", &sphere.scale, true}})) {
+                return false;
+            }
+            scene.spheres.push_back(sphere);
+        } else if (keyword == "light") {
+            SceneDescription::Light light;
+            if (!parseProperties({{"position", &light.position, false}, {"intensity", &light.intensity, true}})) {
+                return false;
+            }
+            scene.lights.push_back(light);
+        } else {
+            return error("unknown keyword " + keyword);
+        }
+        if (next < words.size()) {
+            return error("unexpected " + words[next]);
+        }
+        return true;
+    }
+
+public:
+    SceneParser(std::string path, SceneDescription &scene) : path(std::move(path)), scene(scene) {}
+
+    /**
+     * @brief Parses the file into the scene, the errors are printed.
+     * @return False if the file could not be read or is invalid.
+     */
+    bool parse() {
+        std::ifstream file(path);
+        if (!file.is_open()) {
+            std::cout << "Could not open the scene " << path << std::endl;
+            return false;
+        }
+        std::string line;
+        while (getline(file, line)) {
+            lineNumber++;
+            line = line.substr(0, line.find('#'));
+            std::istringstream stream(line);
+            words.clear();
+            next = 0;
+            std::string word;
+            while (stream >> word) {
+                words.push_back(word);
+            }
+            if (!words.empty()) {
+                next = 1;
+                if (!parseLine(words[0])) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+};
+
+/**
+ * @brief Reads and writes the compiled scenes.
+ * All the values are stored in the byte order of the machine, a compiled scene is meant
+ * to be loaded on the machines it was compiled for.
+ */
+class CompiledScene {
+private:
+    static constexpr char magic[8] = {'R', 'T', 'S', 'C', 'E', 'N', '0', '1'};
+
+    template<typename T>
+    static void write(std::ostream &file, const T &value) {
+        file.write(reinterpret_cast<const char *>(&value), sizeof(T));
+    }
+
+    template<typename T>
+    static bool read(std::ifstream &file, T &value) {
+        return (bool) file.read(reinterpret_cast<char *>(&value), sizeof(T));
+    }
+
+    template<typename T>
+    static void writeVector(std::ostream &file, const std::vector<T> &values) {
+        write(file, (uint64_t) values.size());
+        file.write(reinterpret_cast<const char *>(values.data()), values.size() * sizeof(T));
+    }
+
+    template<typename T>
+    static bool readVector(std::ifstream &file, std::vector<T> &values) {
+        uint64_t size;
+        if (!read(file, size) || size > (1ull << 40) / sizeof(T)) {
+            return false;
+        }
+        values.resize(size);
+        return (bool) file.read(reinterpret_cast<char *>(values.data()), size * sizeof(T));
+    }
+
+    static void writeString(std::ostream &file, const std::string &value) {
+        writeVector(file, std::vector<char>(value.begin(), value.end()));
+    }
+
+    static bool readString(std::ifstream &file, std::string &value) {
+        std::vector<char> chars;
+        if (!readVector(file, chars)) {
+            return false;
+        }
+        value.assign(chars.begin(), chars.end());
+        return true;
+    }
+
+    template<typename Entry, size_t N, typename Function>
+    static int32_t functionIndex(const Entry (&registry)[N], Function function) {
+        return function == nullptr ? -1 : findTextureFunction(registry, [&](const Entry &f) {
+            return f.function == function;
+        });
+    }
+
+    template<typename Entry, size_t N, typename Function>
+    static bool resolveFunction(const Entry (&registry)[N], int32_t index, Function &function) {
+        if (index < -1 || index >= (int32_t) N) {
+            return false;
+        }
+        function = index < 0 ? nullptr : registry[index].function;
+        return true;
+    }
+
+    // plain copy of the values of a material, with the functions replaced by their index in the registry
+    struct MaterialRecord {
+        glm::vec3 ambient, diffuse, specular;
+        float reflection, refraction, sigma, shininess;
+        int32_t texture, normalMap;
+        int32_t hasNormalMap, isAnisotropic, hasImgTexture;
+        float alpha_x, alpha_y;
+        int32_t roughness, occlusion;
+    };
+
+    /**
+     * @brief Stream buffer hashing the bytes written to it with 64 bits FNV-1a instead of storing them.
+     */
+    class HashingBuffer : public std::streambuf {
+    public:
+        uint64_t hash = 14695981039346656037ull;
+
+    protected:
+        int_type overflow(int_type c) override {
+            if (c != traits_type::eof()) {
+                hash = (hash ^ (uint8_t) c) * 1099511628211ull;
+            }
+            return traits_type::not_eof(c);
+        }
+
+        std::streamsize xsputn(const char *bytes, std::streamsize count) override {
+            for (std::streamsize i = 0; i < count; i++) {
+                hash = (hash ^ (uint8_t) bytes[i]) * 1099511628211ull;
+            }
+            return count;
+        }
+    };
+
+    static void writeScene(std::ostream &file, const SceneDescription &scene) {
+        file.write(magic, sizeof(magic));
+        write(file, (int32_t) scene.width);
+        write(file, (int32_t) scene.height);
+        write(file, (int32_t) scene.samples);
+        write(file, scene.camera.origin);
+        write(file, scene.camera.xTiltAngle);
+        write(file, scene.camera.yTiltAngle);
+        write(file, scene.camera.fov);
+        write(file, scene.camera.forward);
+
+        write(file, (uint64_t) scene.materials.size());
+        for (size_t i = 0; i < scene.materials.size(); i++) {
+            const Material &m = scene.materials[i];
+            const MaterialRecord record{m.ambient, m.diffuse, m.specular, m.reflection, m.refraction, m.sigma,
+                                        m.shininess, functionIndex(textureFunctions, m.texture),
+                                        functionIndex(textureFunctions, m.normalMap), m.hasNormalMap,
+                                        m.isAnisotropic, m.hasImgTexture, m.alpha_x, m.alpha_y,
+                                        functionIndex(scalarTextureFunctions, m.roughness),
+                                        functionIndex(scalarTextureFunctions, m.occlusion)};
+            writeString(file, scene.materialNames[i]);
+            write(file, record);
+        }
+
+        write(file, (uint64_t) scene.meshes.size());
+        for (const SceneDescription::Mesh &mesh: scene.meshes) {
+            writeString(file, mesh.path);
+            write(file, mesh.offset);
+            write(file, (int32_t) mesh.material);
+            write(file, (int32_t) mesh.parsed);
+            write(file, mesh.minBounds);
+            write(file, mesh.maxBounds);
+            writeVector(file, mesh.triangles);
+        }
+        writeVector(file, scene.planes);
+        writeVector(file, scene.spheres);
+        writeVector(file, scene.lights);
+    }
+
+public:
+    /**
+     * @brief Checks whether a file starts with the magic number of the compiled scenes.
+     */
+    static bool isCompiled(const std::string &path) {
+        std::ifstream file(path, std::ios::binary);
+        char fileMagic[sizeof(magic)];
+        return file.read(fileMagic, sizeof(fileMagic)) && std::memcmp(fileMagic, magic, sizeof(magic)) == 0;
+    }
+
+    /**
+     * @brief Writes a scene, with the triangles of its parsed meshes.
+     * @return False if the file could not be written.
+     */
+    static bool save(const std::string &path, const SceneDescription &scene) {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            return false;
+        }
+        writeScene(file, scene);
+        file.flush();
+        return (bool) file;
+    }
+
+    /**
+     * @brief Hashes a scene as it would be compiled. The meshes of a text scene are only
+     * described by their path and offset, their triangles are in the hash once parsed.
+     * @return 64 bits FNV-1a hash of the bytes of the compiled scene.
+     */
+    static uint64_t hash(const SceneDescription &scene) {
+        HashingBuffer buffer;
+        std::ostream stream(&buffer);
+        writeScene(stream, scene);
+        return buffer.hash;
+    }
+
+    /**
+     * @brief Reads a compiled scene.
+     * @return False if the file could not be read or is invalid.
+     */
+    static bool load(const std::string &path, SceneDescription &scene) {
+        std::ifstream file(path, std::ios::binary);
+        char fileMagic[sizeof(magic)];
+        if (!file.read(fileMagic, sizeof(fileMagic)) || std::memcmp(fileMagic, magic, sizeof(magic)) != 0) {
+            return false;
+        }
+        int32_t width, height, samples;
+        if (!read(file, width) || !read(file, height) || !read(file, samples) ||
+            !read(file, scene.camera.origin) || !read(file, scene.camera.xTiltAngle) ||
+            !read(file, scene.camera.yTiltAngle) || !read(file, scene.camera.fov) ||
+            !read(file, scene.camera.forward)) {
+            return false;
+        }
+        scene.width = width;
+        scene.height = height;
+        scene.samples = samples;
+
+        uint64_t count;
+        if (!read(file, count)) {
+            return false;
+        }
+        for (uint64_t i = 0; i < count; i++) {
+            std::string name;
+            MaterialRecord record;
+            if (!readString(file, name) || !read(file, record)) {
+                return false;
+            }
+            Material m;
+            m.ambient = record.ambient;
+            m.diffuse = record.diffuse;
+            m.specular = record.specular;
+            m.reflection = record.reflection;
+            m.refraction = record.refraction;
+            m.sigma = record.sigma;
+            m.shininess = record.shininess;
+            m.hasNormalMap = record.hasNormalMap != 0;
+            m.isAnisotropic = record.isAnisotropic != 0;
+            m.hasImgTexture = record.hasImgTexture != 0;
+            m.alpha_x = record.alpha_x;
+            m.alpha_y = record.alpha_y;
+            if (!resolveFunction(textureFunctions, record.texture, m.texture) ||
+                !resolveFunction(textureFunctions, record.normalMap, m.normalMap) ||
+                !resolveFunction(scalarTextureFunctions, record.roughness, m.roughness) ||
+                !resolveFunction(scalarTextureFunctions, record.occlusion, m.occlusion)) {
+                return false;
+            }
+            scene.materialNames.push_back(name);
+            scene.materials.push_back(m);
+        }
+
+        if (!read(file, count)) {
+            return false;
+        }
+        scene.meshes.resize(count);
+        for (SceneDescription::Mesh &mesh: scene.meshes) {
+            int32_t material, parsed;
+            if (!readString(file, mesh.path) || !read(file, mesh.offset) || !read(file, material) ||
+                !read(file, parsed) || !read(file, mesh.minBounds) || !read(file, mesh.maxBounds) || !readVector(file, mesh.triangles)) {
+                return false;
+            }
+            mesh.material = material;
+            mesh.parsed = parsed != 0;
+        }
+        if (!readVector(file, scene.planes) || !readVector(file, scene.spheres) || !readVector(file, scene.lights)) {
+            return false;
+        }
+
+        // the material indices come from the file
+        const int materials = (int) scene.materials.size();
+        for (const SceneDescription::Mesh &mesh: scene.meshes) {
+            if (mesh.material < 0 || mesh.material >= materials) {
+                return false;
+            }
+        }
+        for (const SceneDescription::Plane &plane: scene.planes) {
+            if (plane.material < 0 || plane.material >= materials) {
+                return false;
+            }
+        }
+        for (const SceneDescription::Sphere &sphere: scene.spheres) {
+            if (sphere.material < 0 || sphere.material >= materials) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+/**
+ * @brief Loads a scene, either a text file or a compiled one.
+ * @return False if the scene could not be loaded, the errors are printed.
+ */
+inline bool loadSceneDescription(const std::string &path, SceneDescription &scene) {
+    if (CompiledScene::isCompiled(path)) {
+        if (!CompiledScene::load(path, scene)) {
+            std::cout << "The compiled scene " << path << " is invalid" << std::endl;
+            return false;
+        }
+        return true;
+    }
+    return SceneParser(path, scene).parse();
+}
+
+#endif // SCENE_H
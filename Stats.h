@@ -0,0 +1,201 @@
+#ifndef STATS_H
+#define STATS_H
+
+/*
+ * FEAT: RENDER STATISTICS
+ * Counters of the rays traced, of the intersection tests and of the shading
+ * calls, kept per thread and added up at the end of the render. They are
+ * only compiled in when building with -DRAYTRACER_STATS; otherwise the
+ * STATS(...) statements expand to nothing and the renderer is unchanged.
+ **/
+
+#ifdef RAYTRACER_STATS
+
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <omp.h>
+
+#include "Material.h"
+
+#define STATS(...) __VA_ARGS__
+
+/**
+ * @brief Counters of one thread.
+ */
+struct alignas(64) RenderStats {
+    long primaryRays = 0;    ///< Rays from the camera
+    long shadowRays = 0;     ///< Rays towards the lights, not counting the lights behind the surface
+    long reflectionRays = 0; ///< Reflected rays
+    long refractionRays = 0; ///< Refracted rays
+
+    long objectTests = 0;    ///< Intersection tests with the objects of the scene
+    long objectHits = 0;     ///< Tests that hit the object
+    long bvhNodes = 0;       ///< Bounding boxes of meshes and BVH nodes tested
+    long bvhNodeHits = 0;    ///< Bounding boxes hit
+    long bvhLeaves = 0;      ///< BVH leaves reached
+    long leafTriangles = 0;  ///< Triangles held by the leaves reached
+    long triangleTests = 0;  ///< Ray-triangle intersection tests
+    long triangleHits = 0;   ///< Ray-triangle tests that hit
+
+    std::vector<long> shadingCalls; ///< Shading calls by material, indexed like the material table
+
+    void add(const RenderStats &other) {
+        primaryRays += other.primaryRays;
+        shadowRays += other.shadowRays;
+        reflectionRays += other.reflectionRays;
+        refractionRays += other.refractionRays;
+        objectTests += other.objectTests;
+        objectHits += other.objectHits;
+        bvhNodes += other.bvhNodes;
+        bvhNodeHits += other.bvhNodeHits;
+        bvhLeaves += other.bvhLeaves;
+        leafTriangles += other.leafTriangles;
+        triangleTests += other.triangleTests;
+        triangleHits += other.triangleHits;
+        if (shadingCalls.size() < other.shadingCalls.size()) {
+            shadingCalls.resize(other.shadingCalls.size(), 0);
+        }
+        for (size_t material = 0; material < other.shadingCalls.size(); material++) {
+            shadingCalls[material] += other.shadingCalls[material];
+        }
+    }
+};
+
+std::vector<RenderStats> renderStats; ///< One set of counters per thread
+
+/**
+ * @brief Clears the counters and creates those of every thread, once the materials of the scene are added.
+ */
+inline void resetRenderStats() {
+    renderStats.assign(omp_get_max_threads(), RenderStats());
+    for (RenderStats &stats: renderStats) {
+        stats.shadingCalls.assign(materialTable.size(), 0);
+    }
+}
+
+/**
+ * @brief Counters of the calling thread.
+ */
+inline RenderStats &threadStats() {
+    return renderStats[omp_get_thread_num()];
+}
+
+/**
+ * @brief Shading calls added up by material name, the materials that were never shaded are left out.
+ */
+inline std::map<std::string, long> shadingCallsByName(const RenderStats &stats) {
+    std::map<std::string, long> calls;
+    for (size_t material = 0; material < stats.shadingCalls.size(); material++) {
+        if (stats.shadingCalls[material] > 0) {
+            calls[materialNames[material]] += stats.shadingCalls[material];
+        }
+    }
+    return calls;
+}
+
+inline double statsRatio(long a, long b) {
+    return b > 0 ? (double) a / b : 0.0;
+}
+
+/**
+ * @brief Adds up the counters of all the threads.
+ */
+inline RenderStats totalRenderStats() {
+    RenderStats total;
+    for (const RenderStats &stats: renderStats) {
+        total.add(stats);
+    }
+    return total;
+}
+
+/**
+ * @brief Prints the counters added up over all the threads.
+ */
+inline void printRenderStats() {
+    const RenderStats total = totalRenderStats();
+    printf("Rays: %ld primary, %ld shadow, %ld reflection, %ld refraction\n", total.primaryRays, total.shadowRays,
+           total.reflectionRays, total.refractionRays);
+    printf("Objects: %ld tests, %.2f%% hits\n", total.objectTests,
+           100.0 * statsRatio(total.objectHits, total.objectTests));
+    printf("BVH: %ld nodes visited, %.2f%% hits, %ld leaves of %.1f triangles on average\n", total.bvhNodes,
+           100.0 * statsRatio(total.bvhNodeHits, total.bvhNodes), total.bvhLeaves,
+           statsRatio(total.leafTriangles, total.bvhLeaves));
+    printf("Triangles: %ld tests, %.2f%% hits\n", total.triangleTests,
+           100.0 * statsRatio(total.triangleHits, total.triangleTests));
+    for (const auto &calls: shadingCallsByName(total)) {
+        printf("Shading calls of %s: %ld\n", calls.first.c_str(), calls.second);
+    }
+}
+
+/**
+ * @brief Writes the counters of every thread and their sum as JSON.
+ * @return False if the file could not be written.
+ */
+inline bool writeRenderStatsJSON(const std::string &path) {
+    FILE *file = fopen(path.c_str(), "w");
+    if (file == nullptr) {
+        return false;
+    }
+    auto writeStats = [&](const RenderStats &stats, const char *indent) {
+        fprintf(file, "{\n");
+        const std::pair<const char *, long> counters[] = {
+                {"primary_rays",    stats.primaryRays},
+                {"shadow_rays",     stats.shadowRays},
+                {"reflection_rays", stats.reflectionRays},
+                {"refraction_rays", stats.refractionRays},
+                {"object_tests",    stats.objectTests},
+                {"object_hits",     stats.objectHits},
+                {"bvh_nodes",       stats.bvhNodes},
+                {"bvh_node_hits",   stats.bvhNodeHits},
+                {"bvh_leaves",      stats.bvhLeaves},
+                {"leaf_triangles",  stats.leafTriangles},
+                {"triangle_tests",  stats.triangleTests},
+                {"triangle_hits",   stats.triangleHits},
+        };
+        for (const auto &counter: counters) {
+            fprintf(file, "%s  \"%s\": %ld,\n", indent, counter.first, counter.second);
+        }
+        fprintf(file, "%s  \"object_hit_rate\": %.6f,\n", indent, statsRatio(stats.objectHits, stats.objectTests));
+        fprintf(file, "%s  \"bvh_node_hit_rate\": %.6f,\n", indent, statsRatio(stats.bvhNodeHits, stats.bvhNodes));
+        fprintf(file, "%s  \"triangle_hit_rate\": %.6f,\n", indent,
+                statsRatio(stats.triangleHits, stats.triangleTests));
+        fprintf(file, "%s  \"average_leaf_size\": %.6f,\n", indent, statsRatio(stats.leafTriangles, stats.bvhLeaves));
+        fprintf(file, "%s  \"shading_calls\": {", indent);
+        bool first = true;
+        for (const auto &calls: shadingCallsByName(stats)) {
+            // the names come from the scene file, which cannot contain spaces, quotes are escaped anyway
+            std::string name;
+            for (char c: calls.first) {
+                if (c == '"' || c == '\\') {
+                    name += '\\';
+                }
+                name += c;
+            }
+            fprintf(file, "%s\"%s\": %ld", first ? "" : ", ", name.c_str(), calls.second);
+            first = false;
+        }
+        fprintf(file, "}\n%s}", indent);
+    };
+
+    fprintf(file, "{\n  \"total\": ");
+    writeStats(totalRenderStats(), "  ");
+    fprintf(file, ",\n  \"threads\": [");
+    for (size_t t = 0; t < renderStats.size(); t++) {
+        fprintf(file, "%s\n    ", t > 0 ? "," : "");
+        writeStats(renderStats[t], "    ");
+    }
+    fprintf(file, "\n  ]\n}\n");
+    return fclose(file) == 0;
+}
+
+#else
+
+#define STATS(...)
+
+#endif // RAYTRACER_STATS
+
+#endif // STATS_H
@@ -0,0 +1,250 @@
+#ifndef STRESS_SCENE_H
+#define STRESS_SCENE_H
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "glm/glm.hpp"
+#include "glm/gtc/noise.hpp"
+#include "MeshLoader.h"
+#include "Scene.h"
+
+/*
+ * FEAT: STRESS SCENES
+ * Generated scenes whose size is set on the command line, to measure how the
+ * loading, the BVH construction, the memory and the render time scale:
+ *     --stress crystals=200,spheres=500,lights=8,terrain=10M,seed=1
+ * The crystals are copies of meshes/crystal_big_uv.obj, read once and placed
+ * at random on the ground, each one with its own BVH like the meshes of the
+ * scene files. The spheres get random materials of the sample scene, the
+ * lights share the same total intensity, and the terrain is a height field
+ * of Perlin noise tessellated into the given number of triangles (k and M
+ * suffixes are accepted, up to 100M), built as one mesh.
+ *
+ * Everything lies in a 2 x 2 area in front of a camera looking down at it,
+ * and the same seed always gives the same scene.
+ **/
+
+/**
+ * @brief Size of a stress scene.
+ */
+struct StressSceneSettings {
+    int crystals = 0;
+    int spheres = 0;
+    int lights = 1;
+    long terrainTriangles = 0; ///< 0 for a flat floor instead of the terrain
+    unsigned seed = 1;
+};
+
+/**
+ * @brief Reads the size of a stress scene, given as comma separated name=value pairs.
+ * @return False if a name or a value is not valid, the error is printed.
+ */
+inline bool parseStressSettings(const std::string &description, StressSceneSettings &settings) {
+    std::stringstream pairs(description);
+    std::string pair;
+    while (std::getline(pairs, pair, ',')) {
+        const size_t equal = pair.find('=');
+        const std::string name = pair.substr(0, equal);
+        const std::string value = equal == std::string::npos ? "" : pair.substr(equal + 1);
+        char *end;
+        double number = std::strtod(value.c_str(), &end);
+        if (*end == 'k' || *end == 'K') {
+            number *= 1e3;
+            end++;
+        } else if (*end == 'M') {
+            number *= 1e6;
+            end++;
+        }
+        if (value.empty() || *end != '\0' || number < 0) {
+            std::cout << "Invalid value for " << name << " in the stress scene: " << value << std::endl;
+            return false;
+        }
+        if (name == "crystals") {
+            settings.crystals = (int) number;
+        } else if (name == "spheres") {
+            settings.spheres = (int) number;
+        } else if (name == "lights") {
+            settings.lights = std::max(1, (int) number);
+        } else if (name == "terrain") {
+            settings.terrainTriangles = (long) number;
+        } else if (name == "seed") {
+            settings.seed = (unsigned) number;
+        } else {
+            std::cout << "Unknown setting of the stress scene: " << name << std::endl;
+            return false;
+        }
+    }
+    if (settings.terrainTriangles > 100000000L) {
+        std::cout << "The terrain of a stress scene has at most 100M triangles" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Height of the terrain of the stress scenes at a point of the ground.
+ */
+inline float stressTerrainHeight(float x, float z) {
+    return -0.5f + 0.12f * glm::perlin(glm::vec2(x, z) * 1.5f) + 0.03f * glm::perlin(glm::vec2(x, z) * 6.0f);
+}
+
+/**
+ * @brief Generates a stress scene, using the materials of the sample scene.
+ * @return False if the sample scene or the crystal mesh could not be read.
+ */
+inline bool generateStressScene(const StressSceneSettings &settings, SceneDescription &scene) {
+    if (!loadSceneDescription("./scenes/sample.scene", scene)) {
+        return false;
+    }
+    scene.meshes.clear();
+    scene.planes.clear();
+    scene.spheres.clear();
+    scene.lights.clear();
+    auto material = [&](const char *name) {
+        for (size_t m = 0; m < scene.materialNames.size(); m++) {
+            if (scene.materialNames[m] == name) {
+                return (int) m;
+            }
+        }
+        return 0;
+    };
+
+    scene.camera = Camera();
+    scene.camera.origin = glm::vec3(0.0f, 0.6f, 0.0f);
+    scene.camera.xTiltAngle = 0.35f;
+
+    std::mt19937 generator(settings.seed);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    // the area in front of the camera covered by the objects
+    const glm::vec2 areaMin(-1.0f, 0.8f), areaMax(1.0f, 2.8f);
+    auto randomPoint = [&]() {
+        return glm::mix(areaMin, areaMax, glm::vec2(uniform(generator), uniform(generator)));
+    };
+    const bool terrain = settings.terrainTriangles > 0;
+    auto groundHeight = [&](glm::vec2 point) {
+        return terrain ? stressTerrainHeight(point.x, point.y) : -0.5f;
+    };
+
+    if (terrain) {
+        // a grid of n x n cells of two triangles, the heights and the normals of the vertices are computed once
+        const long cells = std::max(1L, (long) std::sqrt((double) settings.terrainTriangles / 2.0));
+        const long side = cells + 1;
+        const glm::vec2 step = (areaMax - areaMin + 2.0f) / (float) cells;
+        const glm::vec2 origin = areaMin - 1.0f;
+        auto vertex = [&](long i, long j) {
+            const glm::vec2 point = origin + step * glm::vec2((float) i, (float) j);
+            return glm::vec3(point.x, stressTerrainHeight(point.x, point.y), point.y);
+        };
+        std::vector<glm::vec3> vertices((size_t) side * side), normals((size_t) side * side);
+        for (long j = 0; j < side; j++) {
+            for (long i = 0; i < side; i++) {
+                vertices[j * side + i] = vertex(i, j);
+            }
+        }
+        for (long j = 0; j < side; j++) {
+            for (long i = 0; i < side; i++) {
+                // central differences, the vertices around the border of the grid are computed on the fly
+                auto at = [&](long x, long y) {
+                    return x >= 0 && y >= 0 && x < side && y < side ? vertices[y * side + x] : vertex(x, y);
+                };
+                const glm::vec3 dx = at(i + 1, j) - at(i - 1, j);
+                const glm::vec3 dz = at(i, j + 1) - at(i, j - 1);
+                normals[j * side + i] = glm::normalize(glm::cross(dz, dx));
+            }
+        }
+
+        SceneDescription::Mesh mesh;
+        mesh.path = "terrain";
+        mesh.material = material("iceOpaque");
+        mesh.parsed = true;
+        mesh.triangles.reserve((size_t) cells * cells * 2);
+        mesh.minBounds = glm::vec3(INFINITY);
+        mesh.maxBounds = glm::vec3(-INFINITY);
+        for (long j = 0; j < cells; j++) {
+            for (long i = 0; i < cells; i++) {
+                const long corners[4][2] = {{i, j}, {i + 1, j}, {i + 1, j + 1}, {i, j + 1}};
+                const int triangles[2][3] = {{0, 2, 1}, {0, 3, 2}};
+                for (const auto &triangle: triangles) {
+                    TriangleCorners corner{};
+                    for (int k = 0; k < 3; k++) {
+                        const long ci = corners[triangle[k]][0], cj = corners[triangle[k]][1];
+                        corner.positions[k] = vertices[cj * side + ci];
+                        corner.normals[k] = normals[cj * side + ci];
+                        corner.uvs[k] = glm::vec2((float) ci, (float) cj) / (float) cells;
+                        mesh.minBounds = glm::min(mesh.minBounds, corner.positions[k]);
+                        mesh.maxBounds = glm::max(mesh.maxBounds, corner.positions[k]);
+                    }
+                    mesh.triangles.push_back(corner);
+                }
+            }
+        }
+        scene.meshes.push_back(std::move(mesh));
+    } else {
+        SceneDescription::Plane floor;
+        floor.point = glm::vec3(0.0f, -0.5f, 0.0f);
+        floor.material = material("blue_copper_specular");
+        scene.planes.push_back(floor);
+    }
+
+    if (settings.crystals > 0) {
+        SceneDescription::Mesh crystal;
+        if (!MeshLoader::readObj("./meshes/crystal_big_uv.obj", glm::vec3(0.0f), crystal.triangles,
+                                 crystal.minBounds, crystal.maxBounds)) {
+            return false;
+        }
+        const float scale = 2.0f;
+        for (int c = 0; c < settings.crystals; c++) {
+            const glm::vec2 point = randomPoint();
+            // the crystal stands on the ground
+            const glm::vec3 offset(point.x, groundHeight(point) - scale * crystal.minBounds.y, point.y);
+            SceneDescription::Mesh copy;
+            copy.path = "./meshes/crystal_big_uv.obj";
+            copy.offset = offset;
+            copy.material = material("crystal");
+            copy.parsed = true;
+            copy.triangles = crystal.triangles;
+            for (TriangleCorners &corner: copy.triangles) {
+                for (glm::vec3 &position: corner.positions) {
+                    position = scale * position + offset;
+                }
+            }
+            copy.minBounds = scale * crystal.minBounds + offset;
+            copy.maxBounds = scale * crystal.maxBounds + offset;
+            scene.meshes.push_back(std::move(copy));
+        }
+    }
+
+    for (int s = 0; s < settings.spheres; s++) {
+        SceneDescription::Sphere sphere;
+        const glm::vec2 point = randomPoint();
+        const float radius = 0.02f + 0.06f * uniform(generator);
+        sphere.center = glm::vec3(point.x, groundHeight(point) + radius + 0.5f * uniform(generator), point.y);
+        sphere.scale = glm::vec3(radius);
+        sphere.material = (int) (generator() % scene.materials.size());
+        scene.spheres.push_back(sphere);
+    }
+
+    for (int l = 0; l < settings.lights; l++) {
+        SceneDescription::Light light;
+        const glm::vec2 point = randomPoint();
+        light.position = glm::vec3(point.x, 1.5f + uniform(generator), point.y - 0.8f);
+        light.intensity = glm::vec3(10.0f / (float) settings.lights);
+        scene.lights.push_back(light);
+    }
+
+    long triangles = 0;
+    for (const SceneDescription::Mesh &mesh: scene.meshes) {
+        triangles += (long) mesh.triangles.size();
+    }
+    std::cout << "Generated a stress scene of " << settings.crystals << " crystals, " << settings.spheres
+              << " spheres, " << settings.lights << " lights and " << triangles << " triangles" << std::endl;
+    return true;
+}
+
+#endif // STRESS_SCENE_H
@@ -7,6 +7,7 @@
 #include "glm/glm.hpp"
 #include "glm/gtc/noise.hpp"
 #include "bmpmini.hpp"
+#include "Profiler.h"
 
 
 glm::vec3 perlinCalculations(glm::vec2 uv, glm::vec3 u_scales, glm::vec3 v_scales, glm::vec3 offsets) {
@@ -141,6 +142,7 @@ glm::vec3 qwilfishTexture(glm::vec2 uv) {
  * We like handmade textures >:D
 */
 static image::BMPMini loadImage(const std::string &imagePath) {
+    TraceScope trace("load texture", imagePath);
     image::BMPMini bmp;
     bmp.read(imagePath);
     return bmp;
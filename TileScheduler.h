@@ -0,0 +1,378 @@
+#ifndef TILESCHEDULER_H
+#define TILESCHEDULER_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <omp.h>
+
+/*
+ * FEAT: TILE SCHEDULER
+ * The image is split into square tiles which are ordered along a space
+ * filling curve, so that consecutive tiles are neighbours and share most of
+ * the scene data in the caches. Every thread gets a contiguous run of that
+ * order in its own deque and works through it from the front; a thread that
+ * runs out of tiles steals from the back of the fullest deque, i.e. the
+ * tiles that its owner would have rendered last.
+ *
+ * For streamed outputs the tiles can instead be dealt round-robin, with
+ * stealing from the front of the deques, so that the tiles complete in
+ * roughly the order of the list.
+ *
+ * Progress is a single atomic counter that a separate thread prints, so the
+ * rendering threads never touch the console.
+ **/
+
+/**
+ * @brief Structure describing a rectangular tile of the image.
+ */
+struct Tile {
+    // Index of the tile in row-major order.
+    int index;
+
+    // Pixel coordinates of the tile, the end coordinates are excluded.
+    int x0, y0, x1, y1;
+};
+
+/**
+ * @brief Orders in which the tiles can be rendered.
+ */
+enum class TileOrder {
+    Rows,    ///< Row by row, from the top left tile
+    Hilbert, ///< Along a Hilbert curve, neighbouring tiles are rendered close in time
+    Spiral   ///< From the centre of the image outwards
+};
+
+/**
+ * @brief Parses the name of a tile order (rows, hilbert or spiral).
+ * @return True if the name is valid.
+ */
+inline bool parseTileOrder(const std::string &name, TileOrder &order) {
+    if (name == "rows") {
+        order = TileOrder::Rows;
+    } else if (name == "hilbert") {
+        order = TileOrder::Hilbert;
+    } else if (name == "spiral") {
+        order = TileOrder::Spiral;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Class distributing the tiles of an image among the threads.
+ */
+class TileScheduler {
+private:
+    /**
+     * @brief Deque of tiles owned by one thread, aligned to keep the deques of different threads
+     * on different cache lines.
+     */
+    struct alignas(64) WorkQueue {
+        std::mutex mutex;
+        std::deque<Tile> tiles;
+        std::atomic<int> size{0};
+    };
+
+    /**
+     * @brief Time and tiles of one thread, summed over all runs.
+     */
+    struct alignas(64) ThreadStats {
+        double busy = 0.0;
+        double idle = 0.0;
+        int tiles = 0;
+        int stolen = 0;
+    };
+
+    // Tiles in rendering order.
+    std::vector<Tile> tiles;
+
+    std::vector<WorkQueue> queues;
+    std::vector<ThreadStats> stats;
+
+    // Deal the tiles round-robin instead of in contiguous runs.
+    bool interleaved = false;
+
+    // Number of tiles rendered in the current run, read by the progress thread.
+    std::atomic<int> completed{0};
+
+    /**
+     * @brief Converts a distance along the Hilbert curve filling a n x n grid to grid coordinates.
+     * https://en.wikipedia.org/wiki/Hilbert_curve
+     */
+    static void hilbertToGrid(int n, int d, int &x, int &y) {
+        x = y = 0;
+        for (int s = 1; s < n; s *= 2) {
+            const int rx = 1 & (d / 2);
+            const int ry = 1 & (d ^ rx);
+            if (ry == 0) {
+                if (rx == 1) {
+                    x = s - 1 - x;
+                    y = s - 1 - y;
+                }
+                std::swap(x, y);
+            }
+            x += s * rx;
+            y += s * ry;
+            d /= 4;
+        }
+    }
+
+    Tile makeTile(int tile_i, int tile_j) const {
+        Tile tile{};
+        tile.index = tile_j * tiles_x + tile_i;
+        tile.x0 = tile_i * tile_size;
+        tile.y0 = tile_j * tile_size;
+        tile.x1 = std::min(tile.x0 + tile_size, width);
+        tile.y1 = std::min(tile.y0 + tile_size, height);
+        return tile;
+    }
+
+    /**
+     * @brief Takes the next tile for a thread, from its own deque or stolen from another one.
+     * @return False when there are no tiles left.
+     */
+    bool next(int thread, Tile &tile) {
+        WorkQueue &own = queues[thread];
+        {
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tiles.empty()) {
+                tile = own.tiles.front();
+                own.tiles.pop_front();
+                own.size--;
+                return true;
+            }
+        }
+        while (true) {
+            // steal from the thread with the most work left
+            int victim = -1;
+            int victimSize = 0;
+            for (int t = 0; t < (int) queues.size(); t++) {
+                const int size = queues[t].size.load(std::memory_order_relaxed);
+                if (size > victimSize) {
+                    victim = t;
+                    victimSize = size;
+                }
+            }
+            if (victim < 0) {
+                return false;
+            }
+            std::lock_guard<std::mutex> lock(queues[victim].mutex);
+            if (!queues[victim].tiles.empty()) {
+                if (interleaved) {
+                    tile = queues[victim].tiles.front();
+                    queues[victim].tiles.pop_front();
+                } else {
+                    tile = queues[victim].tiles.back();
+                    queues[victim].tiles.pop_back();
+                }
+                queues[victim].size--;
+                stats[thread].stolen++;
+                return true;
+            }
+        }
+    }
+
+public:
+    // Size of the image in pixels.
+    const int width, height;
+
+    // Width and height of a tile in pixels.
+    const int tile_size;
+
+    // Number of tiles in each direction.
+    const int tiles_x, tiles_y;
+
+    /**
+     * @brief Constructor for the scheduler.
+     * @param width Width of the image.
+     * @param height Height of the image.
+     * @param tile_size Width and height of a tile.
+     * @param order Order in which the tiles are rendered.
+     */
+    TileScheduler(int width, int height, int tile_size, TileOrder order)
+            : width(width), height(height), tile_size(tile_size),
+              tiles_x((width + tile_size - 1) / tile_size), tiles_y((height + tile_size - 1) / tile_size) {
+        stats = std::vector<ThreadStats>(omp_get_max_threads());
+        switch (order) {
+            case TileOrder::Rows:
+                for (int tile_j = 0; tile_j < tiles_y; tile_j++)
+                    for (int tile_i = 0; tile_i < tiles_x; tile_i++)
+                        tiles.push_back(makeTile(tile_i, tile_j));
+                break;
+            case TileOrder::Hilbert: {
+                int n = 1;
+                while (n < tiles_x || n < tiles_y) {
+                    n *= 2;
+                }
+                for (int d = 0; d < n * n; d++) {
+                    int tile_i, tile_j;
+                    hilbertToGrid(n, d, tile_i, tile_j);
+                    if (tile_i < tiles_x && tile_j < tiles_y) {
+                        tiles.push_back(makeTile(tile_i, tile_j));
+                    }
+                }
+                break;
+            }
+            case TileOrder::Spiral: {
+                for (int tile_j = 0; tile_j < tiles_y; tile_j++)
+                    for (int tile_i = 0; tile_i < tiles_x; tile_i++)
+                        tiles.push_back(makeTile(tile_i, tile_j));
+                // sort by distance from the centre and then by angle, which walks rings around the centre
+                auto key = [&](const Tile &tile) {
+                    const float dx = (tile.x0 + tile.x1) * 0.5f - width * 0.5f;
+                    const float dy = (tile.y0 + tile.y1) * 0.5f - height * 0.5f;
+                    const float ring = std::max(std::abs(dx), std::abs(dy)) / tile_size;
+                    return std::make_pair((int) std::floor(ring), std::atan2(dy, dx));
+                };
+                std::stable_sort(tiles.begin(), tiles.end(),
+                                 [&](const Tile &a, const Tile &b) { return key(a) < key(b); });
+                break;
+            }
+        }
+    }
+
+    /**
+     * @brief Gets the tiles in rendering order.
+     */
+    const std::vector<Tile> &getTiles() const { return tiles; }
+
+    /**
+     * @brief Restricts the rendering to a rectangle of the image: the tiles not intersecting it are
+     * dropped and the others are clipped to it. The tiles keep their position and index in the full image.
+     * @param x0 x coordinate of the left column of the region.
+     * @param y0 y coordinate of the top row of the region.
+     * @param x1 x coordinate after the right column of the region.
+     * @param y1 y coordinate after the bottom row of the region.
+     */
+    void setRegion(int x0, int y0, int x1, int y1) {
+        std::vector<Tile> clipped;
+        for (Tile tile: tiles) {
+            tile.x0 = std::max(tile.x0, x0);
+            tile.y0 = std::max(tile.y0, y0);
+            tile.x1 = std::min(tile.x1, x1);
+            tile.y1 = std::min(tile.y1, y1);
+            if (tile.x0 < tile.x1 && tile.y0 < tile.y1) {
+                clipped.push_back(tile);
+            }
+        }
+        tiles.swap(clipped);
+    }
+
+    /**
+     * @brief Replaces the tiles to render, e.g. with the batch of tiles handed to a distributed worker.
+     * @param subset Tiles of this image, in rendering order.
+     */
+    void setTiles(std::vector<Tile> subset) { tiles = std::move(subset); }
+
+    /**
+     * @brief Deals the tiles round-robin among the threads, which then complete them in about
+     * the rendering order. Needed when the finished tiles are streamed to a file.
+     */
+    void setInterleaved(bool value) { interleaved = value; }
+
+    /**
+     * @brief Renders the given tiles with all the OpenMP threads.
+     * @param work Function rendering one tile, called concurrently from several threads.
+     * @param showProgress Prints the progress on the console while rendering.
+     */
+    void run(const std::function<void(const Tile &)> &work, bool showProgress = true) {
+        const std::vector<Tile> &order = tiles;
+        const int threads = (int) stats.size();
+
+        queues = std::vector<WorkQueue>(threads);
+        if (interleaved) {
+            for (size_t k = 0; k < order.size(); k++) {
+                queues[k % threads].tiles.push_back(order[k]);
+            }
+        } else {
+            // every thread starts with a contiguous part of the order
+            for (int t = 0; t < threads; t++) {
+                const size_t begin = order.size() * t / threads;
+                const size_t end = order.size() * (t + 1) / threads;
+                queues[t].tiles.assign(order.begin() + begin, order.begin() + end);
+            }
+        }
+        for (WorkQueue &queue: queues) {
+            queue.size = (int) queue.tiles.size();
+        }
+        completed = 0;
+
+        // the progress thread is woken up as soon as the last tile is done, not at its next update
+        const int total = (int) order.size();
+        std::mutex doneMutex;
+        std::condition_variable doneCondition;
+        bool done = false;
+        auto finish = [&]() {
+            std::lock_guard<std::mutex> lock(doneMutex);
+            done = true;
+            doneCondition.notify_all();
+        };
+        std::thread progress;
+        if (showProgress) {
+            progress = std::thread([&]() {
+                std::unique_lock<std::mutex> lock(doneMutex);
+                while (!done) {
+                    printf("Progress: %.2f%%\r", 100.0 * completed / std::max(total, 1));
+                    fflush(stdout);
+                    doneCondition.wait_for(lock, std::chrono::milliseconds(250), [&]() { return done; });
+                }
+            });
+        }
+
+        std::vector<double> busyBefore;
+        for (const ThreadStats &threadStats: stats) {
+            busyBefore.push_back(threadStats.busy);
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+#pragma omp parallel num_threads(threads)
+        {
+            const int thread = omp_get_thread_num();
+            Tile tile{};
+            while (next(thread, tile)) {
+                const auto tileStart = std::chrono::steady_clock::now();
+                work(tile);
+                stats[thread].busy += std::chrono::duration<double>(
+                        std::chrono::steady_clock::now() - tileStart).count();
+                stats[thread].tiles++;
+                if (completed.fetch_add(1, std::memory_order_relaxed) + 1 == total) {
+                    finish();
+                }
+            }
+        }
+        const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        for (int t = 0; t < threads; t++) {
+            stats[t].idle += std::max(0.0, elapsed - (stats[t].busy - busyBefore[t]));
+        }
+
+        // without any tile to render, nothing has woken up the progress thread
+        finish();
+        if (progress.joinable()) {
+            progress.join();
+        }
+    }
+
+    /**
+     * @brief Prints the time every thread spent rendering and waiting.
+     */
+    void printThreadStats() const {
+        for (int t = 0; t < (int) stats.size(); t++) {
+            printf("Thread %d: %d tiles (%d stolen), busy %.3f s, idle %.3f s\n", t, stats[t].tiles,
+                   stats[t].stolen, stats[t].busy, stats[t].idle);
+        }
+    }
+};
+
+#endif // TILESCHEDULER_H
@@ -0,0 +1,353 @@
+/**
+@file benchmark.cpp
+*/
+
+#include "glm/glm.hpp"
+#include "glm/gtx/transform.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Renderer.h"
+#include "Profiler.h"
+
+/*
+ * FEAT: MICROBENCHMARKS
+ * Times the kernels of the renderer in isolation: the intersection functions
+ * of the primitives, the BVH traversal of every mesh of meshes/ with random
+ * and with coherent rays, the Phong shading of the materials of the sample
+ * scene, the tone mapping and the texture functions. Every benchmark is run a
+ * few times to warm the caches up, then timed over several repetitions, and
+ * the median, the fastest and the slowest repetition are reported in
+ * nanoseconds per operation.
+ *
+ * The inputs are drawn from a generator with a fixed seed, so two runs of
+ * the same build measure the same work.
+ **/
+
+/**
+ * @brief Timings of one benchmark, in nanoseconds per operation.
+ */
+struct BenchmarkResult {
+    string name;
+    long operations; ///< Operations done by one repetition
+    double median, fastest, slowest;
+};
+
+/**
+ * @brief Settings shared by all the benchmarks.
+ */
+struct BenchmarkSettings {
+    int warmup = 3;
+    int repetitions = 15;
+    string filter; ///< Only the benchmarks whose name contains it are run
+};
+
+/**
+ * @brief Whether a benchmark passes the filter of the settings.
+ */
+bool isSelected(const BenchmarkSettings &settings, const string &name) {
+    return name.find(settings.filter) != string::npos;
+}
+
+volatile float benchmarkSink; ///< Receives the results of the kernels, so that the compiler keeps them
+
+/**
+ * @brief Runs a benchmark and prints its timings.
+ * @param name Name of the benchmark.
+ * @param operations Operations done by one call of the body.
+ * @param body Runs the operations, returning a value depending on all their results.
+ */
+template<typename Body>
+void runBenchmark(const BenchmarkSettings &settings, vector<BenchmarkResult> &results, const string &name,
+                  long operations, Body body) {
+    if (!isSelected(settings, name) || operations <= 0) {
+        return;
+    }
+    float sink = 0.0f;
+    for (int i = 0; i < settings.warmup; i++) {
+        sink += body();
+    }
+    vector<double> times;
+    for (int i = 0; i < settings.repetitions; i++) {
+        const auto start = chrono::steady_clock::now();
+        sink += body();
+        const auto end = chrono::steady_clock::now();
+        times.push_back(chrono::duration<double, nano>(end - start).count() / (double) operations);
+    }
+    benchmarkSink = sink;
+
+    sort(times.begin(), times.end());
+    const BenchmarkResult result{name, operations, times[times.size() / 2], times.front(), times.back()};
+    printf("%-48s %12.1f %12.1f %12.1f\n", name.c_str(), result.median, result.fastest, result.slowest);
+    fflush(stdout);
+    results.push_back(result);
+}
+
+/**
+ * @brief Rays from a sphere of the given radius around a box, aimed at random points of the box.
+ */
+vector<Ray> randomRays(mt19937 &generator, glm::vec3 minBounds, glm::vec3 maxBounds, int count) {
+    uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    normal_distribution<float> gaussian;
+    const glm::vec3 center = 0.5f * (minBounds + maxBounds);
+    const float radius = glm::max(glm::length(maxBounds - minBounds), 1e-3f);
+    vector<Ray> rays;
+    rays.reserve(count);
+    for (int i = 0; i < count; i++) {
+        glm::vec3 away(gaussian(generator), gaussian(generator), gaussian(generator));
+        const glm::vec3 origin = center + radius * glm::normalize(away + glm::vec3(1e-6f));
+        const glm::vec3 target = glm::mix(minBounds, maxBounds,
+                                          glm::vec3(uniform(generator), uniform(generator), uniform(generator)));
+        rays.emplace_back(origin, glm::normalize(target - origin));
+    }
+    return rays;
+}
+
+/**
+ * @brief Rays of a pinhole camera in front of a box, looking down -z and covering the box in a size x size grid.
+ */
+vector<Ray> coherentRays(glm::vec3 minBounds, glm::vec3 maxBounds, int size) {
+    const glm::vec3 center = 0.5f * (minBounds + maxBounds);
+    const glm::vec3 extent = glm::max(maxBounds - minBounds, glm::vec3(1e-3f));
+    const glm::vec3 origin(center.x, center.y, maxBounds.z + glm::max(extent.x, extent.y));
+    vector<Ray> rays;
+    rays.reserve((size_t) size * size);
+    for (int j = 0; j < size; j++)
+        for (int i = 0; i < size; i++) {
+            const glm::vec3 target(minBounds.x + extent.x * ((float) i + 0.5f) / (float) size,
+                                   maxBounds.y - extent.y * ((float) j + 0.5f) / (float) size, center.z);
+            rays.emplace_back(origin, glm::normalize(target - origin));
+        }
+    return rays;
+}
+
+/**
+ * @brief Times the intersection of random rays with an object, without the surface at the intersections.
+ */
+void benchmarkIntersections(const BenchmarkSettings &settings, vector<BenchmarkResult> &results, const string &name,
+                            Object &object, vector<Ray> &rays) {
+    runBenchmark(settings, results, name, (long) rays.size(), [&]() {
+        float sum = 0.0f;
+        for (Ray &ray: rays) {
+            const HitRecord hit = object.findHit(ray);
+            sum += hit.hit() ? hit.distance : 0.0f;
+        }
+        return sum;
+    });
+}
+
+void printUsage() {
+    cout << "Usage: benchmark [options]\n"
+            "  --warmup N          untimed runs of every benchmark (default 3)\n"
+            "  --repetitions N     timed runs of every benchmark, the median is reported (default 15)\n"
+            "  --filter TEXT       only run the benchmarks whose name contains TEXT\n"
+            "  --json PATH         also write the results as JSON\n"
+            "  --help              print this message\n";
+}
+
+bool writeResultsJSON(const string &path, const BenchmarkSettings &settings, const vector<BenchmarkResult> &results) {
+    FILE *file = fopen(path.c_str(), "w");
+    if (file == nullptr) {
+        return false;
+    }
+    fprintf(file, "{\n  \"warmup\": %d,\n  \"repetitions\": %d,\n  \"unit\": \"ns/op\",\n  \"benchmarks\": [",
+            settings.warmup, settings.repetitions);
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchmarkResult &result = results[i];
+        // the names are made of mesh, material and function names, which do not need escaping
+        fprintf(file, "%s\n    {\"name\": \"%s\", \"operations\": %ld, \"median\": %.3f, \"min\": %.3f, "
+                      "\"max\": %.3f}", i > 0 ? "," : "", result.name.c_str(), result.operations, result.median,
+                result.fastest, result.slowest);
+    }
+    fprintf(file, "\n  ]\n}\n");
+    return fclose(file) == 0;
+}
+
+int main(int argc, const char *argv[]) {
+    TraceProfiler::get().disable();
+
+    BenchmarkSettings settings;
+    string jsonPath;
+    for (int i = 1; i < argc; i++) {
+        const string option = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (option == "--warmup" && hasValue) {
+            settings.warmup = max(0, atoi(argv[++i]));
+        } else if (option == "--repetitions" && hasValue) {
+            settings.repetitions = max(1, atoi(argv[++i]));
+        } else if (option == "--filter" && hasValue) {
+            settings.filter = argv[++i];
+        } else if (option == "--json" && hasValue) {
+            jsonPath = argv[++i];
+        } else if (option == "--help") {
+            printUsage();
+            return 0;
+        } else {
+            cout << "Unknown option " << option << endl;
+            printUsage();
+            return 1;
+        }
+    }
+
+    // the kernels are timed on one thread
+    omp_set_num_threads(1);
+    mt19937 generator(2024);
+    uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    vector<BenchmarkResult> results;
+    printf("%-48s %12s %12s %12s\n", "benchmark (ns/op)", "median", "min", "max");
+
+    // primitives, in a unit box around the origin
+    {
+        glm::vec3 minBounds(-1.0f), maxBounds(1.0f);
+        vector<Ray> rays = randomRays(generator, minBounds, maxBounds, 4096);
+        Sphere sphere{addMaterial(Material())};
+        sphere.setTransformation(glm::scale(glm::vec3(0.8f)));
+        // a sphere scaled differently along each axis is intersected with its matrices
+        Sphere ellipsoid{addMaterial(Material())};
+        ellipsoid.setTransformation(glm::scale(glm::vec3(0.8f, 0.5f, 0.8f)));
+        Plane plane(glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f), true);
+        Cone cone{addMaterial(Material())};
+        cone.setTransformation(glm::translate(glm::vec3(0.0f, -1.0f, 0.0f)) * glm::scale(glm::vec3(0.8f, 2.0f, 0.8f)));
+        Triangle triangle(glm::vec3(-1.0f, -1.0f, 0.0f), glm::vec3(1.0f, -1.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+        glm::vec3 boxMin(-0.5f), boxMax(0.5f);
+        BoundingBox box(boxMin, boxMax);
+        benchmarkIntersections(settings, results, "intersect/sphere", sphere, rays);
+        benchmarkIntersections(settings, results, "intersect/ellipsoid", ellipsoid, rays);
+        benchmarkIntersections(settings, results, "intersect/plane", plane, rays);
+        benchmarkIntersections(settings, results, "intersect/cone", cone, rays);
+        benchmarkIntersections(settings, results, "intersect/triangle", triangle, rays);
+        benchmarkIntersections(settings, results, "intersect/bounding_box", box, rays);
+    }
+
+    // BVH traversal of every mesh
+    vector<string> meshPaths;
+    error_code error;
+    for (const auto &entry: filesystem::directory_iterator("./meshes", error)) {
+        if (entry.path().extension() == ".obj") {
+            meshPaths.push_back(entry.path().string());
+        }
+    }
+    sort(meshPaths.begin(), meshPaths.end());
+    for (const string &path: meshPaths) {
+        const string name = "bvh/" + filesystem::path(path).stem().string();
+        if (!isSelected(settings, name + "/random") && !isSelected(settings, name + "/coherent")) {
+            continue;
+        }
+        vector<TriangleCorners> corners;
+        glm::vec3 minBounds, maxBounds;
+        if (!MeshLoader::readObj(path, glm::vec3(0.0f), corners, minBounds, maxBounds) || corners.empty()) {
+            continue;
+        }
+        MeshLoader object(corners, minBounds, maxBounds, true);
+        vector<Ray> random = randomRays(generator, minBounds, maxBounds, 1024);
+        vector<Ray> coherent = coherentRays(minBounds, maxBounds, 32);
+        benchmarkIntersections(settings, results, name + "/random", object, random);
+        benchmarkIntersections(settings, results, name + "/coherent", object, coherent);
+    }
+
+    // Phong shading of the points seen by the camera of the sample scene, with every material of the scene
+    {
+        SceneDescription scene;
+        const bool shading = loadSceneDescription("./scenes/sample.scene", scene) &&
+                             any_of(scene.materialNames.begin(), scene.materialNames.end(), [&](const string &name) {
+                                 return isSelected(settings, "shade/" + name);
+                             });
+        if (shading) {
+            // buildScene adds the materials of the scene one after the other at the end of the material table
+            const MaterialId firstMaterial = (MaterialId) materialTable.size();
+            buildScene(scene);
+            shadowCaches.resize(omp_get_max_threads());
+            for (ShadowCache &cache: shadowCaches) {
+                cache.lastOccluder.assign(lights.size(), nullptr);
+            }
+            STATS(resetRenderStats());
+
+            const Camera::View view = scene.camera.view(64, 48);
+            vector<Hit> hits;
+            vector<glm::vec3> viewDirections;
+            for (int j = 0; j < 48; j++)
+                for (int i = 0; i < 64; i++) {
+                    Ray ray = view.ray(i, j, glm::vec2(0.5f));
+                    Hit hit = closest(ray);
+                    if (hit.hit) {
+                        // the image textures only read texture coordinates inside the image
+                        hit.uv = glm::mix(glm::vec2(0.001f), glm::vec2(0.999f), glm::fract(hit.uv));
+                        hits.push_back(hit);
+                        viewDirections.push_back(glm::normalize(-ray.direction));
+                    }
+                }
+            // without bounces, so that only the shading of the hit point is timed and not the reflected rays
+            for (size_t m = 0; m < scene.materials.size(); m++) {
+                const Material &material = scene.materials[m];
+                // the hits are shaded as if they were on an object of this material
+                vector<Hit> materialHits = hits;
+                for (Hit &hit: materialHits) {
+                    hit.material = (MaterialId) (firstMaterial + m);
+                }
+                runBenchmark(settings, results, "shade/" + scene.materialNames[m], (long) hits.size(), [&]() {
+                    float sum = 0.0f;
+                    for (size_t h = 0; h < materialHits.size(); h++) {
+                        const Hit &hit = materialHits[h];
+                        sum += PhongModel(hit.intersection, hit.normal, hit.normalShading, hit.uv, viewDirections[h],
+                                          material, 0, hit).x;
+                    }
+                    return sum;
+                });
+            }
+        }
+    }
+
+    // tone mapping and textures
+    {
+        vector<glm::vec3> intensities(4096);
+        vector<glm::vec2> uvs(4096);
+        for (glm::vec3 &intensity: intensities) {
+            intensity = 2.0f * glm::vec3(uniform(generator), uniform(generator), uniform(generator));
+        }
+        for (glm::vec2 &uv: uvs) {
+            uv = glm::mix(glm::vec2(0.001f), glm::vec2(0.999f), glm::vec2(uniform(generator), uniform(generator)));
+        }
+        runBenchmark(settings, results, "tone_mapping", (long) intensities.size(), [&]() {
+            float sum = 0.0f;
+            for (const glm::vec3 &intensity: intensities) {
+                sum += toneMapping(intensity).x;
+            }
+            return sum;
+        });
+        for (const TextureFunction &texture: textureFunctions) {
+            runBenchmark(settings, results, string("texture/") + texture.name, (long) uvs.size(), [&]() {
+                float sum = 0.0f;
+                for (const glm::vec2 &uv: uvs) {
+                    sum += texture.function(uv).x;
+                }
+                return sum;
+            });
+        }
+        for (const ScalarTextureFunction &texture: scalarTextureFunctions) {
+            runBenchmark(settings, results, string("texture/") + texture.name, (long) uvs.size(), [&]() {
+                float sum = 0.0f;
+                for (const glm::vec2 &uv: uvs) {
+                    sum += texture.function(uv);
+                }
+                return sum;
+            });
+        }
+    }
+
+    if (!jsonPath.empty()) {
+        if (!writeResultsJSON(jsonPath, settings, results)) {
+            cout << "Could not write the results to " << jsonPath << endl;
+            return 1;
+        }
+        cout << "Wrote the results to " << jsonPath << endl;
+    }
+    return 0;
+}
@@ -7,655 +7,1068 @@
 #include "glm/gtx/transform.hpp"
 #include "glm/trigonometric.hpp"
 #include "glm/gtx/vector_angle.hpp"
+#include "glm/gtx/component_wise.hpp"
 
+#include <algorithm>
 #include <iostream>
 #include <omp.h>
+#include <atomic>
 #include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sys/resource.h>
 
-#include "Objects.h"
-#include "MeshLoader.h"
+#include "Renderer.h"
 #include "Image.h"
+#include "Sampler.h"
+#include "TileScheduler.h"
+#include "Camera.h"
+#include "Scene.h"
+#include "RenderServer.h"
+#include "Checkpoint.h"
+#include "Distributed.h"
+#include "Stats.h"
+#include "Heatmap.h"
+#include "Profiler.h"
+#include "Golden.h"
+#include "StressScene.h"
 
 using namespace std;
 
-constexpr float EPSILON = 0.001f;
+/**
+ Function tracing one sample through a pixel, taking the x and y coordinates of the pixel
+ and the index of the sample inside the pixel
+ */
+using SampleFunction = function<glm::vec3(int, int, int)>;
 
 /**
- Light class
+ Settings controlling how many samples are traced through every pixel
  */
-class Light {
-public:
-    glm::vec3 position; ///< Position of the light source
-    glm::vec3 color;    ///< Color/intentisty of the light source
-    explicit Light(glm::vec3 position) : position(position), color(glm::vec3(1.0)) {}
-
-    Light(glm::vec3 position, glm::vec3 color)
-            : position(position), color(color) {}
+struct SamplingSettings {
+    int bounces = 3;                   ///< Reflections and refractions followed from every camera ray
+
+    // FEAT: ADAPTIVE SUPER SAMPLING
+    int minSamples = 2;                ///< Samples traced for every pixel
+    int maxSamples = 4;                ///< Upper bound on the samples of a pixel
+    float varianceThreshold = 0.0001f; ///< Per channel variance above which a pixel is refined
+    float edgeThreshold = 0.02f;       ///< Per channel difference with a neighbour above which both are refined
+
+    // FEAT: SAMPLE PATTERNS
+    SamplePattern pattern = SamplePattern::Jitter4; ///< Pattern used to place the samples inside the pixels
+
+    // FEAT: PROGRESSIVE RENDERING
+    bool progressive = false;          ///< Render the whole frame one sample per pixel at a time
+    double timeBudget = INFINITY;      ///< Seconds after which the progressive render stops
+    double checkpointInterval = 30.0;  ///< Seconds between two checkpoints of the progressive render
+    float noiseTarget = 0.0f;          ///< Average standard error of the pixels at which the progressive render stops
 };
 
-vector<Light *> lights; ///< A list of lights in the scene
-glm::vec3 ambient_light(0.7);
-vector<Object *> objects; ///< A list of all objects in the scene
-
-
-bool is_shadowed(glm::vec3 point, glm::vec3 normal, glm::vec3 direction,
-                 const float distance) {
-    // avoid sending shadow rays towards lights behind the surface
-    if (glm::dot(normal, direction) < 0) {
-        return true;
-    }
-
-    // origin of the shadow ray is moved a little to avoid self intersection
-    Ray shadowRay = Ray(point + EPSILON * direction, direction);
-    for (Object *object: objects) {
-        Hit hit = object->intersect(shadowRay);
-        if (hit.hit && hit.distance <= distance) {
-            return true;
+/**
+ Renders the image tile by tile, refining only the pixels whose samples disagree
+ @param output Function storing the rendered tiles, called concurrently from several threads
+ @param scheduler Scheduler distributing the tiles among the threads
+ @param settings Sampling settings
+ @param traceSample Function tracing one sample through a pixel
+ @param checkpoint If not nullptr, the finished tiles are appended to it and the tiles it already
+ holds are read back instead of being rendered
+ @param showProgress Prints the progress on the console while rendering
+ @return Number of samples traced
+ */
+long renderAdaptive(const TileResultFunction &output, TileScheduler &scheduler, const SamplingSettings &settings,
+                    const SampleFunction &traceSample, RenderCheckpoint *checkpoint = nullptr,
+                    bool showProgress = true) {
+    TraceScope trace("render");
+    atomic<long> totalSamples(0); // number of samples traced over the whole image
+
+    scheduler.run([&](const Tile &tile) {
+        // the detail is only formatted when it is recorded, not for every tile of every render
+        TraceScope trace("tile", TraceProfiler::get().isRecording() ? to_string(tile.x0) + " " + to_string(tile.y0)
+                                                                    : string());
+
+        // FEAT: CHECKPOINT AND RESUME
+        if (checkpoint != nullptr && checkpoint->isCompleted(tile.index)) {
+            vector<glm::vec3> colors;
+            const long samples = checkpoint->readTile(tile.index, colors);
+            totalSamples += samples;
+            output(tile, colors.data(), samples);
+            return;
         }
-    }
-    return false;
-}
 
-Hit closest(Ray ray) {
-    Hit closest_hit{};
+        const int tile_i_start = tile.x0; // the x coordinate of the tile
+        const int tile_j_start = tile.y0; // the y coordinate of the tile
+        const int tile_i_end = tile.x1;   // the x coordinate of the tile + tile_size
+        const int tile_j_end = tile.y1;   // the y coordinate of the tile + tile_size
 
-    closest_hit.hit = false;
-    closest_hit.distance = INFINITY;
+        const int tile_width = tile_i_end - tile_i_start;
+        const int tile_height = tile_j_end - tile_j_start;
 
-    for (auto &object: objects) {
-        Hit hit = object->intersect(ray);
-        if (hit.hit && hit.distance < closest_hit.distance)
-            closest_hit = hit;
-    }
-    return closest_hit;
-}
-
-/** Function for computing color of an object according to the Phong Model
- @param point A point belonging to the object for which the color is computer
- @param normal A normal vector the the point
- @param uv Texture coordinates
- @param view_direction A normalized direction from the point to the
- viewer/camera
- @param material A material structure representing the material of the object
-*/
-glm::vec3 PhongModel(glm::vec3 point, glm::vec3 normal, glm::vec3 normalShading, glm::vec2 uv,
-                     glm::vec3 view_direction, Material material,
-                     const int maxBounces, Hit hit) {
+        // running sums of the samples of every pixel of the tile
+        vector<glm::vec3> pixelColor(tile_width * tile_height, glm::vec3(0.0f));
+        vector<glm::vec3> pixelColorSquared(tile_width * tile_height, glm::vec3(0.0f));
+        vector<int> pixelSamples(tile_width * tile_height, 0);
 
-    glm::vec3 color(0.0);
-
-    // flip normal if it is pointing away from the view direction
-    if (glm::dot(normal, view_direction) < 0) {
-        normal = -normal;
-    }
-    // flip shading normal if it is pointing away from the view direction
-    if (glm::dot(normalShading, view_direction) < 0) {
-        normalShading = -normalShading;
-    }
+        auto addSample = [&](int i, int j) {
+            const int p = (j - tile_j_start) * tile_width + (i - tile_i_start);
+            glm::vec3 sampleColor = traceSample(i, j, pixelSamples[p]);
+            pixelColor[p] += sampleColor;
+            pixelColorSquared[p] += sampleColor * sampleColor;
+            pixelSamples[p]++;
+        };
 
-    for (Light *light: lights) {
-        glm::vec3 light_direction = glm::normalize(light->position - point);
-        const float distance_from_light = glm::distance(point, light->position);
+        //FEAT: SUPER SAMPLING ANTI ALIASING (SSAA)
+        for (int i = tile_i_start; i < tile_i_end; i++)
+            for (int j = tile_j_start; j < tile_j_end; j++)
+                for (int sample = 0; sample < settings.minSamples; ++sample)
+                    addSample(i, j);
+
+        // FEAT: ADAPTIVE SUPER SAMPLING
+        // a pixel is refined if its own samples disagree or if it differs from a neighbour in the tile,
+        // since all of its first samples may have landed on the same side of an edge
+        vector<bool> refine(tile_width * tile_height, false);
+        for (int y = 0; y < tile_height; y++)
+            for (int x = 0; x < tile_width; x++) {
+                const int p = y * tile_width + x;
+                glm::vec3 mean = pixelColor[p] / (float) pixelSamples[p];
+                glm::vec3 variance = pixelColorSquared[p] / (float) pixelSamples[p] - mean * mean;
+                if (glm::compMax(variance) > settings.varianceThreshold) {
+                    refine[p] = true;
+                }
+                if (x + 1 < tile_width) {
+                    glm::vec3 right = pixelColor[p + 1] / (float) pixelSamples[p + 1];
+                    if (glm::compMax(glm::abs(mean - right)) > settings.edgeThreshold) {
+                        refine[p] = refine[p + 1] = true;
+                    }
+                }
+                if (y + 1 < tile_height) {
+                    glm::vec3 below = pixelColor[p + tile_width] / (float) pixelSamples[p + tile_width];
+                    if (glm::compMax(glm::abs(mean - below)) > settings.edgeThreshold) {
+                        refine[p] = refine[p + tile_width] = true;
+                    }
+                }
+            }
 
-        if (!is_shadowed(point, normal, light_direction, distance_from_light)) {
+        long tileSamples = 0;
+        for (int i = tile_i_start; i < tile_i_end; i++)
+            for (int j = tile_j_start; j < tile_j_end; j++) {
+                const int p = (j - tile_j_start) * tile_width + (i - tile_i_start);
+                if (refine[p]) {
+                    while (pixelSamples[p] < settings.maxSamples)
+                        addSample(i, j);
+                }
+                tileSamples += pixelSamples[p];
+                pixelColor[p] /= (float) pixelSamples[p];
+            }
+        if (checkpoint != nullptr) {
+            checkpoint->writeTile(tile.index, pixelColor.data(), tileSamples);
+        }
+        output(tile, pixelColor.data(), tileSamples);
+        totalSamples += tileSamples;
+    }, showProgress);
+    return totalSamples;
+}
 
-            glm::vec3 diffuse_color =
-                    material.texture != nullptr ? material.texture(uv) : material.diffuse;
-            const float diffuse = max(0.0f, glm::dot(light_direction, normalShading));
+/**
+ Stores the linear colors of a rendered tile in an image, tone mapped
+ @param image Image where the tile is stored
+ @param tile Rendered tile
+ @param colors Linear colors of the pixels of the tile, row by row
+ @param imageOrigin Position of the top left pixel of the image in the frame, when the image is cropped
+ */
+void storeTileInImage(Image &image, const Tile &tile, const glm::vec3 *colors, glm::ivec2 imageOrigin) {
+    TraceScope trace("tone mapping");
+    const int tile_width = tile.x1 - tile.x0;
+    for (int j = tile.y0; j < tile.y1; j++)
+        for (int i = tile.x0; i < tile.x1; i++) {
+            const glm::vec3 &color = colors[(j - tile.y0) * tile_width + (i - tile.x0)];
+            image.setHDRPixel(i - imageOrigin.x, j - imageOrigin.y, color);
+            image.setPixel(i - imageOrigin.x, j - imageOrigin.y, toneMapping(color));
+        }
+}
 
-            glm::vec3 h =
-                    glm::normalize(light_direction + view_direction); // half vector
+/**
+ FEAT: PROGRESSIVE RENDERING
+ Renders the whole image one sample per pixel at a time and accumulates the passes.
+ The first pass always covers the whole frame; later passes stop as soon as the time budget
+ is exhausted, and no pass is started once the noise target is reached. The image is
+ written to the checkpoint path every checkpointInterval seconds so that killing the
+ process does not lose the work done so far.
+ @param image Image where the result is stored
+ @param scheduler Scheduler distributing the tiles among the threads
+ @param settings Sampling settings
+ @param traceSample Function tracing one sample through a pixel
+ @param checkpointPath Path where the intermediate images are written
+ @param start Time at which the render job started, the time budget is measured from it
+ @param imageOrigin Position of the top left pixel of the image in the frame, when the image is cropped
+ @return Number of samples traced
+ */
+long renderProgressive(Image &image, TileScheduler &scheduler, const SamplingSettings &settings,
+                       const SampleFunction &traceSample, const char *checkpointPath,
+                       chrono::steady_clock::time_point start, glm::ivec2 imageOrigin = glm::ivec2(0)) {
+    const int width = scheduler.width;
+    const int height = scheduler.height;
+
+    // running sums and counts of the samples of every pixel, stored tile by tile like the tiles are rendered
+    Framebuffer<RGB32F> pixelColor(width, height, FramebufferLayout::TileMajor, scheduler.tile_size);
+    Framebuffer<RGB32F> pixelColorSquared(width, height, FramebufferLayout::TileMajor, scheduler.tile_size);
+    Framebuffer<int> pixelSamples(width, height, FramebufferLayout::TileMajor, scheduler.tile_size);
+
+    auto elapsed = [&]() {
+        return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    };
 
-            const float distance = max(0.1f, distance_from_light);
-            const float attenuation = 1.0f / glm::pow(distance, 2);
-            glm::vec3 diffusion = attenuation * light->color * diffuse_color * diffuse;
+    mutex imageMutex; // guards the image against checkpoints written while tiles are stored
+    double lastCheckpoint = elapsed();
 
-            glm::vec3 specular_term = glm::vec3(0.0f); // Initialize to zero
+    for (int pass = 0; pass < settings.maxSamples; pass++) {
+        TraceScope passTrace("pass", to_string(pass));
+        atomic<bool> outOfTime(false);
 
-            float shiny;
-            if (material.hasImgTexture) {
-                shiny = (0.5f / pow((material.roughness(uv)), 4)) - 0.5f;
-            } else {
-                shiny = material.shininess;
+        scheduler.run([&](const Tile &tile) {
+            if (pass > 0 && elapsed() > settings.timeBudget) {
+                outOfTime = true;
+                return;
             }
+            TraceScope trace("tile", TraceProfiler::get().isRecording()
+                                     ? "pass " + to_string(pass) + ", " + to_string(tile.x0) + " " + to_string(tile.y0)
+                                     : string());
+            const int tile_i_start = tile.x0;
+            const int tile_j_start = tile.y0;
+            const int tile_i_end = tile.x1;
+            const int tile_j_end = tile.y1;
+
+            for (int i = tile_i_start; i < tile_i_end; i++)
+                for (int j = tile_j_start; j < tile_j_end; j++) {
+                    glm::vec3 sampleColor = traceSample(i, j, pass);
+                    pixelColor.at(i, j).set(pixelColor.at(i, j).get() + sampleColor);
+                    pixelColorSquared.at(i, j).set(pixelColorSquared.at(i, j).get() + sampleColor * sampleColor);
+                    pixelSamples.at(i, j)++;
+                }
 
-            // FEAT: SPECULAR HIGHLIGHTS
-            if (material.isAnisotropic) {
-                // https://en.wikipedia.org/wiki/Specular_highlight#Ward_anisotropic_distribution
-
-                float NdotL = glm::dot(normalShading, light_direction);
-                float NdotV = glm::dot(normalShading, view_direction);
-
-                if (NdotL > 0 && NdotV > 0) {
-                    float HdotTangent = glm::dot(h, hit.tangent);
-                    float HdotBitangent = glm::dot(h, hit.bitangent);
-                    float HdotN = glm::dot(h, normalShading);
-
-                    float exponent = -2.0f * (glm::pow((HdotTangent / material.alpha_x), 2.0f)
-                                              * glm::pow((HdotBitangent / material.alpha_y), 2.0f)) / (1 + HdotN);
-
-                    specular_term = (material.specular * NdotL * exp(exponent)) /
-                                    (sqrt(NdotL * NdotV) * 4 * glm::pi<float>() * material.alpha_x * material.alpha_y);
+            lock_guard<mutex> lock(imageMutex);
+            TraceScope toneMappingTrace("tone mapping");
+            for (int i = tile_i_start; i < tile_i_end; i++)
+                for (int j = tile_j_start; j < tile_j_end; j++) {
+                    const glm::vec3 mean = pixelColor.at(i, j).get() / (float) pixelSamples.at(i, j);
+                    image.setHDRPixel(i - imageOrigin.x, j - imageOrigin.y, mean);
+                    image.setPixel(i - imageOrigin.x, j - imageOrigin.y, toneMapping(mean));
                 }
-            } else {
-                const float specular = max(0.0f, glm::pow(glm::dot(h, normalShading), 4 * shiny));
-                specular_term = attenuation * light->color * material.specular * specular;
+            // the first pass leaves not yet rendered tiles black, which is still worth saving
+            if (elapsed() - lastCheckpoint >= settings.checkpointInterval) {
+                image.writeImage(checkpointPath);
+                lastCheckpoint = elapsed();
             }
+        }, pass == 0);
+
+        // noise of the image estimated as the average standard error of the pixel means
+        double noise = 0.0;
+        long pixels = 0;
+        for (const Tile &tile: scheduler.getTiles())
+            for (int j = tile.y0; j < tile.y1; j++)
+                for (int i = tile.x0; i < tile.x1; i++) {
+                    const float n = (float) pixelSamples.at(i, j);
+                    glm::vec3 mean = pixelColor.at(i, j).get() / n;
+                    glm::vec3 variance = glm::max(pixelColorSquared.at(i, j).get() / n - mean * mean, glm::vec3(0.0f));
+                    noise += sqrt(glm::compMax(variance) / n);
+                    pixels++;
+                }
+        noise /= max(pixels, 1L);
 
-            color += diffusion + specular_term;
+        cout << "Pass " << pass + 1 << "/" << settings.maxSamples << " done after " << elapsed() << " seconds";
+        if (pass > 0) {
+            cout << ", noise " << noise;
         }
-    }
-    if (maxBounces > 0) {
+        cout << endl;
 
-        glm::vec3 reflection(0.0f);
+        if (outOfTime) {
+            cout << "Time budget of " << settings.timeBudget << " seconds reached" << endl;
+            break;
+        }
+        if (pass > 0 && noise <= settings.noiseTarget) {
+            cout << "Noise target of " << settings.noiseTarget << " reached" << endl;
+            break;
+        }
+    }
 
-        if (material.reflection > 0) {
-            color *= 1 - material.reflection;
-            glm::vec3 reflection_direction = glm::reflect(-view_direction, normalShading);
-            glm::vec3 reflection_position = point + EPSILON * reflection_direction;
-            Ray reflection_ray = Ray(reflection_position, reflection_direction);
+    long totalSamples = 0;
+    for (const Tile &tile: scheduler.getTiles())
+        for (int j = tile.y0; j < tile.y1; j++)
+            for (int i = tile.x0; i < tile.x1; i++) {
+                totalSamples += pixelSamples.at(i, j);
+            }
+    return totalSamples;
+}
 
-            Hit closest_hit = closest(reflection_ray);
+/**
+ Function tracing one ray through a pixel, taking the x and y coordinates of the pixel
+ and the offset of the ray from the centre of the pixel
+ */
+using PixelFunction = function<glm::vec3(int, int, glm::vec2)>;
 
-            if (closest_hit.hit) {
-                reflection =
-                        material.reflection *
-                        PhongModel(closest_hit.intersection, closest_hit.normal, closest_hit.normalShading,
-                                   closest_hit.uv, glm::normalize(-reflection_direction),
-                                   closest_hit.object->getMaterial(), maxBounces - 1, closest_hit);
+/**
+ FEAT: SAMPLE PATTERNS
+ Measures how fast every sample pattern converges on a window in the middle of the image.
+ A reference is rendered with many Sobol samples, then every pattern renders the window with
+ an increasing number of samples and the RMSE of the tonemapped pixels against the reference is printed.
+ @param tracePixel Function tracing one ray through a pixel
+ */
+void convergenceBenchmark(const int width, const int height, const PixelFunction &tracePixel) {
+    const int window = 32;            // width and height of the measured window
+    const int referenceSamples = 256; // samples per pixel of the reference
+    const int maxSamples = 16;        // the patterns are measured with 1, 2, 4, ... maxSamples samples
+
+    const int x0 = max(0, width / 2 - window / 2);
+    const int y0 = max(0, height / 2 - window / 2);
+    const int x1 = min(width, x0 + window);
+    const int y1 = min(height, y0 + window);
+    const int pixels = (x1 - x0) * (y1 - y0);
+
+    auto renderWindow = [&](const Sampler &sampler, int samples) {
+        vector<glm::vec3> result(pixels);
+#pragma omp parallel for schedule(dynamic, 1)
+        for (int p = 0; p < pixels; p++) {
+            const int i = x0 + p % (x1 - x0);
+            const int j = y0 + p / (x1 - x0);
+            glm::vec3 color(0.0f);
+            for (int sample = 0; sample < samples; sample++) {
+                color += tracePixel(i, j, sampler.sample(i, j, sample));
             }
+            result[p] = toneMapping(color / (float) samples);
         }
+        return result;
+    };
 
-        glm::vec3 refraction(0.0f);
-
-        if (material.refraction > 0) {
-            color *= (1 - material.refraction);
-            const bool is_entering = glm::dot(normalShading, -view_direction) < 0.0f;
+    cout << "Rendering the " << referenceSamples << " samples per pixel reference" << endl;
+    const vector<glm::vec3> reference = renderWindow(Sampler(SamplePattern::Sobol, referenceSamples),
+                                                     referenceSamples);
+
+    cout << "pattern      spp   rmse        seconds" << endl;
+    for (SamplePattern pattern: {SamplePattern::Jitter4, SamplePattern::Stratified, SamplePattern::R2,
+                                 SamplePattern::Sobol, SamplePattern::BlueNoise}) {
+        const Sampler sampler(pattern, maxSamples);
+        for (int samples = 1; samples <= sampler.getSamplesPerPixel(); samples *= 2) {
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            const vector<glm::vec3> result = renderWindow(sampler, samples);
+            const double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+            double squaredError = 0.0;
+            for (int p = 0; p < pixels; p++) {
+                glm::vec3 difference = result[p] - reference[p];
+                squaredError += glm::dot(difference, difference) / 3.0;
+            }
+            printf("%-12s %-5d %-11.6f %.3f\n", samplePatternName(pattern), samples,
+                   sqrt(squaredError / pixels), seconds);
+        }
+    }
+}
 
-            const float n1 = is_entering ? 1.0f : material.sigma;
-            const float n2 = is_entering ? material.sigma : 1.0f;
-            const float eta = n1 / n2;
+/**
+ FEAT: RENDER SERVER
+ Renders one request of the render server, with the scene already loaded
+ @param request Options of the request, the missing ones keep the values given on the command line
+ @param path Path of the image file, whose extension gives the format
+ @param camera Camera of the scene
+ @param settings Sampling settings given on the command line
+ @param width Width of the image given by the scene
+ @param height Height of the image given by the scene
+ @param tile_size Width and height of the tiles
+ @param tileOrder Order in which the tiles are rendered
+ @return An empty string on success, otherwise the error
+ */
+string renderServerJob(const RenderRequest &request, const string &path, Camera camera, SamplingSettings settings,
+                       int width, int height, int tile_size, TileOrder tileOrder) {
+    glm::ivec4 crop(0, 0, -1, -1);
+    for (const auto &option: request) {
+        const string &name = option.first;
+        const char *value = option.second.c_str();
+        bool valid = true;
+        if (name == "width") {
+            width = atoi(value);
+        } else if (name == "height") {
+            height = atoi(value);
+        } else if (name == "samples") {
+            settings.maxSamples = max(1, atoi(value));
+        } else if (name == "min-samples") {
+            settings.minSamples = max(1, atoi(value));
+        } else if (name == "bounces") {
+            settings.bounces = max(0, atoi(value));
+        } else if (name == "sampler") {
+            valid = parseSamplePattern(value, settings.pattern);
+        } else if (name == "origin") {
+            valid = sscanf(value, "%f,%f,%f", &camera.origin.x, &camera.origin.y, &camera.origin.z) == 3;
+        } else if (name == "tilt") {
+            valid = sscanf(value, "%f,%f", &camera.xTiltAngle, &camera.yTiltAngle) == 2;
+        } else if (name == "fov") {
+            valid = sscanf(value, "%f", &camera.fov) == 1;
+        } else if (name == "crop") {
+            valid = sscanf(value, "%d,%d,%d,%d", &crop.x, &crop.y, &crop.z, &crop.w) == 4;
+        } else if (name != "format" && name != "output") {
+            return "unknown option " + name;
+        }
+        if (!valid) {
+            return "invalid value for " + name;
+        }
+    }
+    if (width < 1 || height < 1 || width > 16384 || height > 16384) {
+        return "invalid resolution";
+    }
+    if (crop.z < 0 || crop.w < 0) {
+        crop = glm::ivec4(0, 0, width, height);
+    }
+    crop = glm::clamp(crop, glm::ivec4(0), glm::ivec4(width, height, width, height));
+    if (crop.x >= crop.z || crop.y >= crop.w) {
+        return "empty crop window";
+    }
 
-            glm::vec3 refraction_direction =
-                    glm::refract(-view_direction, is_entering ? normalShading : -normalShading, eta);
-            glm::vec3 refraction_position = point + EPSILON * refraction_direction;
+    const Sampler sampler(settings.pattern, settings.maxSamples);
+    settings.maxSamples = sampler.getSamplesPerPixel();
+    settings.minSamples = min(settings.minSamples, settings.maxSamples);
+    const Camera::View view = camera.view(width, height);
+    auto traceSample = [&](int i, int j, int sample) {
+        return trace_ray(view.ray(i, j, sampler.sample(i, j, sample)), settings.bounces);
+    };
 
-            Ray refraction_ray = Ray(refraction_position, refraction_direction);
+    Image image(crop.z - crop.x, crop.w - crop.y, Image::isHDRPath(path.c_str()), tile_size);
+    TileScheduler scheduler(width, height, tile_size, tileOrder);
+    scheduler.setRegion(crop.x, crop.y, crop.z, crop.w);
+    renderAdaptive([&](const Tile &tile, const glm::vec3 *colors, long) {
+        storeTileInImage(image, tile, colors, glm::ivec2(crop.x, crop.y));
+    }, scheduler, settings, traceSample, nullptr, false);
 
-            Hit closest_hit = closest(refraction_ray);
+    if (!image.writeImage(path.c_str())) {
+        return "could not write " + path;
+    }
+    return "";
+}
 
-            if (closest_hit.hit) {
-                refraction =
-                        material.refraction *
-                        PhongModel(closest_hit.intersection, closest_hit.normal, closest_hit.normalShading,
-                                   closest_hit.uv, glm::normalize(-refraction_direction),
-                                   closest_hit.object->getMaterial(), maxBounces - 1, closest_hit);
 
-                float O1 = cos(glm::angle(normalShading, view_direction));
-                float O2 = cos(glm::angle(-normalShading, refraction_direction));
+/**
+ Peak resident memory of the process so far, in megabytes
+ */
+double peakMemoryMegabytes() {
+    struct rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024.0;
+}
 
-                float R = 0.5f * (pow((n1 * O1 - n2 * O2) / (n1 * O1 + n2 * O2), 2) +
-                                  pow((n1 * O2 - n2 * O1) / (n1 * O2 + n2 * O1), 2));
-                float T = 1 - R;
+/**
+ Prints the options of the command line
+ */
+void printUsage(const char *program) {
+    cout << "Usage: " << program << " [output.ppm|png|pfm|exr] [options]\n"
+            "Scene and image:\n"
+            "  --scene FILE               scene to render, as text or compiled (./scenes/competition.scene)\n"
+            "  --compile-scene OUT        compile the scene to a binary file and exit\n"
+            "  --stress SETTINGS          generate a stress scene, e.g. crystals=100,spheres=50,lights=4,terrain=1M\n"
+            "  --output PATH              image to write, the format follows the extension (./result.ppm)\n"
+            "  --width W, --height H      resolution, overriding the scene (1024 x 768)\n"
+            "  --fov DEGREES              horizontal field of view, overriding the scene (90)\n"
+            "  --crop X0 Y0 X1 Y1         only render this region of the frame\n"
+            "  --full-frame               write the cropped region into a full-size image\n"
+            "Sampling:\n"
+            "  --samples N                samples per pixel at most, overriding the scene (4)\n"
+            "  --min-samples N            samples traced for every pixel (2)\n"
+            "  --bounces N                reflections and refractions of every camera ray (3)\n"
+            "  --sampler NAME             jitter4, stratified, r2, sobol or bluenoise (jitter4)\n"
+            "  --progressive              render one sample per pixel at a time over the whole frame\n"
+            "  --time-budget S            stop the progressive render after S seconds\n"
+            "  --noise-target N           stop the progressive render at this noise\n"
+            "  --checkpoint-interval S    seconds between two saves of the image or of the checkpoint (30)\n"
+            "Threads and tiles:\n"
+            "  --threads N                number of threads (all the cores)\n"
+            "  --tile-size N              width and height of the tiles (16)\n"
+            "  --tile-order NAME          hilbert, spiral or rows (hilbert)\n"
+            "  --stream                   write the tiles to the output as they are finished\n"
+            "  --checkpoint               save the finished tiles to <output>.ckpt\n"
+            "  --checkpoint-file PATH     save the finished tiles to PATH\n"
+            "  --resume                   only render the tiles missing from the checkpoint\n"
+            "Distributed rendering and serving:\n"
+            "  --coordinator PORT         hand out the tiles to workers on this TCP port\n"
+            "  --workers N                start N workers on this machine\n"
+            "  --tile-timeout S           reissue the tiles of a worker silent for S seconds (60)\n"
+            "  --worker HOST:PORT         render the tiles of a coordinator\n"
+            "  --serve SOCKET             keep the scene loaded and render the requests of a UNIX socket\n"
+            "Measurements:\n"
+            "  --benchmark N              render N times and print the median time\n"
+            "  --convergence              compare how fast the sample patterns converge\n"
+            "  --golden DIR               render the golden cases and compare them with the references in DIR\n"
+            "  --update-golden            replace the references of --golden with new renders\n"
+            "  --psnr-threshold DB        smallest PSNR of a golden render against its reference (35)\n"
+            "  --trace PATH               write the timeline of the run as a Chrome trace\n"
+            "  --heatmap                  write the cost of every pixel next to the render, as output.cycles.ppm\n"
+            "  --stats-json PATH          write the ray statistics as JSON (built with -DRAYTRACER_STATS)\n";
+}
 
-                reflection *= R;
-                refraction *= T;
+int main(int argc, const char *argv[]) {
+    chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+    chrono::steady_clock::time_point jobStart = chrono::steady_clock::now();
+
+    const char *outputPath = "./result.ppm";
+    SamplingSettings settings;
+    bool convergence = false; // run the sample pattern convergence benchmark instead of rendering
+    int tile_size = 16; // width and height of the tiles distributed among the threads
+    TileOrder tileOrder = TileOrder::Hilbert; // order in which the tiles are rendered
+    bool streaming = false; // write the tiles to the output as they are finished instead of keeping the image
+    bool checkpointing = false; // append the finished tiles to a checkpoint file
+    bool resume = false; // keep the tiles of the checkpoint of a previous run
+    string checkpointPath; // path of the checkpoint file, the output path followed by .ckpt by default
+    glm::ivec4 crop(0, 0, -1, -1); // region to render as x0, y0, x1, y1 with x1 and y1 excluded, the whole frame by default
+    bool fullFrame = false; // write the region into a full-size image instead of a cropped one
+    int coordinatorPort = -1; // TCP port on which the tiles are handed out to workers, -1 to render locally
+    int localWorkers = 0; // number of worker processes started by the coordinator on this machine
+    double tileTimeout = 60.0; // seconds without any result after which the tiles of a worker are reissued
+    string coordinatorAddress; // host:port of the coordinator, when running as a worker
+    string serverSocket; // UNIX socket on which render requests are served, empty to render one image
+    string scenePath = "./scenes/competition.scene"; // scene file, as text or compiled
+    string compiledScenePath; // where the scene is compiled to instead of rendering it
+    bool stressing = false; // generate a stress scene instead of reading the scene file
+    StressSceneSettings stress; // size of the generated stress scene
+    bool samplesGiven = false; // the samples were set on the command line, overriding the scene
+    int width = 0, height = 0; // resolution set on the command line, 0 to keep the one of the scene
+    float fov = 0; // field of view set on the command line, 0 to keep the one of the scene
+    int threads = 0; // number of threads, 0 for the OpenMP default
+    int benchmarkRuns = 0; // number of timed renders of the benchmark, 0 to render once
+    string statsPath; // JSON file receiving the render statistics, empty to only print them
+    bool heatmapping = false; // write the cost of every pixel as false-color images next to the render
+    string tracePath; // Chrome trace receiving the timeline of the run, empty to not record it
+    string goldenDirectory; // reference images of the golden benchmark, empty to render normally
+    bool updateGolden = false; // replace the reference images instead of comparing the renders with them
+    double psnrThreshold = 35.0; // smallest PSNR of a golden render against its reference, in dB
+    for (int arg = 1; arg < argc; arg++) {
+        const string option = argv[arg];
+        if (option == "--progressive") {
+            settings.progressive = true;
+        } else if (option == "--time-budget" && arg + 1 < argc) {
+            settings.timeBudget = atof(argv[++arg]);
+        } else if (option == "--checkpoint-interval" && arg + 1 < argc) {
+            settings.checkpointInterval = atof(argv[++arg]);
+        } else if (option == "--noise-target" && arg + 1 < argc) {
+            settings.noiseTarget = (float) atof(argv[++arg]);
+        } else if (option == "--sampler" && arg + 1 < argc) {
+            if (!parseSamplePattern(argv[++arg], settings.pattern)) {
+                cout << "Unknown sample pattern " << argv[arg] << endl;
+                return 1;
+            }
+        } else if (option == "--samples" && arg + 1 < argc) {
+            settings.maxSamples = max(1, atoi(argv[++arg]));
+            samplesGiven = true;
+        } else if (option == "--min-samples" && arg + 1 < argc) {
+            settings.minSamples = max(1, atoi(argv[++arg]));
+        } else if (option == "--tile-size" && arg + 1 < argc) {
+            tile_size = max(1, atoi(argv[++arg]));
+        } else if (option == "--tile-order" && arg + 1 < argc) {
+            if (!parseTileOrder(argv[++arg], tileOrder)) {
+                cout << "Unknown tile order " << argv[arg] << endl;
+                return 1;
+            }
+        } else if (option == "--stream") {
+            streaming = true;
+        } else if (option == "--checkpoint") {
+            checkpointing = true;
+        } else if (option == "--resume") {
+            checkpointing = resume = true;
+        } else if (option == "--checkpoint-file" && arg + 1 < argc) {
+            checkpointing = true;
+            checkpointPath = argv[++arg];
+        } else if (option == "--crop" && arg + 4 < argc) {
+            for (int k = 0; k < 4; k++) {
+                crop[k] = atoi(argv[++arg]);
             }
+        } else if (option == "--full-frame") {
+            fullFrame = true;
+        } else if (option == "--coordinator" && arg + 1 < argc) {
+            coordinatorPort = max(0, atoi(argv[++arg]));
+        } else if (option == "--workers" && arg + 1 < argc) {
+            localWorkers = max(0, atoi(argv[++arg]));
+        } else if (option == "--tile-timeout" && arg + 1 < argc) {
+            tileTimeout = atof(argv[++arg]);
+        } else if (option == "--worker" && arg + 1 < argc) {
+            coordinatorAddress = argv[++arg];
+        } else if (option == "--serve" && arg + 1 < argc) {
+            serverSocket = argv[++arg];
+        } else if (option == "--scene" && arg + 1 < argc) {
+            scenePath = argv[++arg];
+        } else if (option == "--stress" && arg + 1 < argc) {
+            if (!parseStressSettings(argv[++arg], stress)) {
+                return 1;
+            }
+            stressing = true;
+        } else if (option == "--compile-scene" && arg + 1 < argc) {
+            compiledScenePath = argv[++arg];
+        } else if (option == "--output" && arg + 1 < argc) {
+            outputPath = argv[++arg];
+        } else if (option == "--width" && arg + 1 < argc) {
+            width = max(1, atoi(argv[++arg]));
+        } else if (option == "--height" && arg + 1 < argc) {
+            height = max(1, atoi(argv[++arg]));
+        } else if (option == "--fov" && arg + 1 < argc) {
+            fov = (float) atof(argv[++arg]);
+        } else if (option == "--bounces" && arg + 1 < argc) {
+            settings.bounces = max(0, atoi(argv[++arg]));
+        } else if (option == "--threads" && arg + 1 < argc) {
+            threads = max(1, atoi(argv[++arg]));
+        } else if (option == "--benchmark" && arg + 1 < argc) {
+            benchmarkRuns = max(1, atoi(argv[++arg]));
+        } else if (option == "--trace" && arg + 1 < argc) {
+            tracePath = argv[++arg];
+        } else if (option == "--heatmap") {
+            heatmapping = true;
+        } else if (option == "--stats-json" && arg + 1 < argc) {
+            statsPath = argv[++arg];
+        } else if (option == "--convergence") {
+            convergence = true;
+        } else if (option == "--golden" && arg + 1 < argc) {
+            goldenDirectory = argv[++arg];
+        } else if (option == "--update-golden") {
+            updateGolden = true;
+        } else if (option == "--psnr-threshold" && arg + 1 < argc) {
+            psnrThreshold = atof(argv[++arg]);
+        } else if (option == "--help" || option == "-h") {
+            printUsage(argv[0]);
+            return 0;
+        } else if (option[0] == '-') {
+            cout << "Unknown option or missing value: " << option << "\n";
+            printUsage(argv[0]);
+            return 1;
+        } else {
+            outputPath = argv[arg];
         }
-        color += reflection + refraction;
-    }
-    if (material.hasImgTexture) {
-        color += ambient_light * 0.1f * material.occlusion(uv);
-    } else {
-        color += ambient_light * material.ambient;
     }
-    return color;
-}
 
-/**
- Functions that computes a color along the ray
- @param ray Ray that should be traced through the scene
- @param bounces number of bounces
- @return Color at the intersection point
- */
-glm::vec3 trace_ray(Ray ray, int bounces) {
-    Hit closest_hit = closest(ray);
+    if (threads > 0) {
+        omp_set_num_threads(threads);
+    }
 
-    glm::vec3 color(0.0);
+    // FEAT: TRACE PROFILER
+    // the profiler has been recording since the textures were loaded, before main
+    if (tracePath.empty()) {
+        TraceProfiler::get().disable();
+    }
+    auto writeTrace = [&]() {
+        if (!tracePath.empty()) {
+            if (TraceProfiler::get().write(tracePath)) {
+                cout << "Wrote the trace to " << tracePath << endl;
+            } else {
+                cout << "Could not write the trace to " << tracePath << endl;
+            }
+        }
+    };
 
-    if (closest_hit.hit) {
-        color = PhongModel(closest_hit.intersection, closest_hit.normal, closest_hit.normalShading,
-                           closest_hit.uv, glm::normalize(-ray.direction),
-                           closest_hit.object->getMaterial(), bounces, closest_hit);
+    // FEAT: GOLDEN IMAGES
+    // every case is rendered by a new process, which gets --benchmark and does not come back here
+    if (!goldenDirectory.empty()) {
+        const int runs = max(benchmarkRuns, 1);
+        return runGoldenBenchmark(goldenDirectory, updateGolden, psnrThreshold, threads, runs) ? 0 : 1;
     }
-    // clamp the final color to [0,1]
-    return glm::clamp(color, glm::vec3(0.0), glm::vec3(1.0));
-}
+    if (updateGolden) {
+        cout << "--update-golden needs --golden DIR" << endl;
+        return 1;
+    }
+    cout << "Running on " << omp_get_max_threads() << " threads\n";
 
-/**
- Function performing tonemapping of the intensities computed using the raytracer
- @param intensity Input intensity
- @return Tonemapped intensity in range (0,1)
- */
-glm::vec3 toneMapping(glm::vec3 intensity) {
+    if (streaming && settings.progressive) {
+        cout << "--stream cannot be used with --progressive, which needs the whole image" << endl;
+        return 1;
+    }
 
-    float alpha = 1.5f;
-    float beta = 1.8f;
-    float gamma = 2.2f;
-    float oneOverGamma = 1.0f / gamma;
+    if (checkpointing && settings.progressive) {
+        cout << "--progressive writes its own checkpoints, see --checkpoint-interval" << endl;
+        return 1;
+    }
+    const bool coordinating = coordinatorPort >= 0;
+    const bool working = !coordinatorAddress.empty();
+    if ((coordinating || working) && (settings.progressive || streaming)) {
+        cout << "Distributed rendering cannot be used with --progressive or --stream" << endl;
+        return 1;
+    }
+    const bool serving = !serverSocket.empty();
+    if (serving && (settings.progressive || streaming || checkpointing || coordinating || working)) {
+        cout << "--serve cannot be used with --progressive, --stream, --checkpoint or distributed rendering" << endl;
+        return 1;
+    }
+    const bool benchmarking = benchmarkRuns > 0;
+    if (benchmarking && (settings.progressive || streaming || checkpointing || coordinating || working || serving)) {
+        cout << "--benchmark cannot be used with --progressive, --stream, --checkpoint, --serve or distributed rendering"
+             << endl;
+        return 1;
+    }
+    // the costs of the repeated renders of a benchmark would add up in the same pixels
+    if (heatmapping && (benchmarking || coordinating || working || serving)) {
+        cout << "--heatmap cannot be used with --benchmark, --serve or distributed rendering" << endl;
+        return 1;
+    }
+    if (checkpointPath.empty()) {
+        checkpointPath = string(outputPath) + ".ckpt";
+    }
 
-    glm::vec3 new_intensity;
+    // FEAT: SCENE FILES
+    // FEAT: STRESS SCENES
+    SceneDescription scene;
+    const string sceneName = stressing ? "the stress scene" : scenePath;
+    const auto loadStart = chrono::steady_clock::now();
+    {
+        TraceScope trace("load scene", sceneName);
+        if (stressing ? !generateStressScene(stress, scene) : !loadSceneDescription(scenePath, scene)) {
+            return 1;
+        }
+    }
+    const double loadSeconds = chrono::duration<double>(chrono::steady_clock::now() - loadStart).count();
+    if (!compiledScenePath.empty()) {
+        scene.parseMeshes();
+        if (!CompiledScene::save(compiledScenePath, scene)) {
+            cout << "Could not compile " << sceneName << " to " << compiledScenePath << endl;
+            return 1;
+        }
+        cout << "Compiled " << sceneName << " to " << compiledScenePath << endl;
+        return 0;
+    }
 
-    new_intensity.x = pow(alpha * pow(intensity.x, beta), oneOverGamma);
-    new_intensity.y = pow(alpha * pow(intensity.y, beta), oneOverGamma);
-    new_intensity.z = pow(alpha * pow(intensity.z, beta), oneOverGamma);
+    // the scene gives the resolution, the field of view and the samples, unless they are set on the command line
+    if (width == 0) {
+        width = scene.width > 0 ? scene.width : 1024;
+    }
+    if (height == 0) {
+        height = scene.height > 0 ? scene.height : 768;
+    }
+    if (fov > 0) {
+        scene.camera.fov = fov;
+    }
+    if (scene.samples > 0 && !samplesGiven) {
+        settings.maxSamples = scene.samples;
+    }
 
-    glm::vec3 tonemapped =
-            min(new_intensity, glm::vec3(1.0)); // tonemapped intensity
-    return glm::clamp(tonemapped, glm::vec3(0.0), glm::vec3(1.0));
-}
+    // FEAT: CROP WINDOW
+    // the camera always covers the whole frame, only the rendered pixels change
+    if (crop.z < 0 || crop.w < 0) {
+        crop = glm::ivec4(0, 0, width, height);
+    }
+    crop = glm::clamp(crop, glm::ivec4(0), glm::ivec4(width, height, width, height));
+    if (crop.x >= crop.z || crop.y >= crop.w) {
+        cout << "The crop window is empty" << endl;
+        return 1;
+    }
+    if (streaming && fullFrame && crop != glm::ivec4(0, 0, width, height)) {
+        cout << "--stream cannot be used with --full-frame, the rows outside the crop window are never rendered" << endl;
+        return 1;
+    }
+    // size of the written image and position of its top left pixel in the frame
+    const int imageWidth = fullFrame ? width : crop.z - crop.x;
+    const int imageHeight = fullFrame ? height : crop.w - crop.y;
+    const glm::ivec2 imageOrigin = fullFrame ? glm::ivec2(0) : glm::ivec2(crop.x, crop.y);
+
+    const auto buildStart = chrono::steady_clock::now();
+    // the triangles of the meshes are handed over to the objects when the scene is built, it is hashed before
+    const uint64_t sceneHash = checkpointing || coordinating || working ? CompiledScene::hash(scene) : 0;
+    {
+        TraceScope trace("build scene", sceneName);
+        buildScene(scene);
+    }
+    const double buildSeconds = chrono::duration<double>(chrono::steady_clock::now() - buildStart).count();
+    cout << "Scene was loaded succesfully in " << loadSeconds << " seconds and built in " << buildSeconds
+         << " seconds, peak memory " << peakMemoryMegabytes() << " MB\n";
 
-void sampleScene() {
-
-    Material orange;
-    orange.diffuse = glm::vec3(1.0f, 0.6f, 0.1f);
-    orange.ambient = glm::vec3(0.01f, 0.03f, 0.03f);
-    orange.specular = glm::vec3(0.03f);
-    orange.isAnisotropic = true;
-    orange.alpha_x = 1.0f;
-    orange.alpha_y = 1.0f;
-
-    Material orange_highlight;
-    orange_highlight.diffuse = glm::vec3(1.0f, 0.6f, 0.1f);
-    orange_highlight.ambient = glm::vec3(0.01f, 0.03f, 0.03f);
-    orange_highlight.specular = glm::vec3(0.03f);
-    orange_highlight.isAnisotropic = true;
-    orange_highlight.alpha_x = 0.5f;
-    orange_highlight.alpha_y = 0.2f;
-
-    Material blue_copper_specular;
-    blue_copper_specular.ambient = glm::vec3(0.07f, 0.07f, 0.1f);
-    blue_copper_specular.diffuse = glm::vec3(0.2f, 0.8f, 0.8f);
-    blue_copper_specular.specular = glm::vec3(0.6);
-    blue_copper_specular.shininess = 100.0;
-
-    Material img_texture;
-    img_texture.hasImgTexture = true;
-    img_texture.hasNormalMap = true;
-    img_texture.normalMap = &normalAt;
-    img_texture.texture = &colorAt;
-    img_texture.roughness = &roughnessAt;
-    img_texture.occlusion = &ambientOcclusionAt;
-
-    Material perla;
-    perla.texture = &opal;
-    perla.shininess = 0.9f;
-    perla.refraction = 0.5f;
-    perla.reflection = 0.1f;
-    perla.sigma = 2.0f;
-
-    Material glass;
-    glass.ambient = glm::vec3(0.0f);
-    glass.diffuse = glm::vec3(0.0f);
-    glass.specular = glm::vec3(0.0f);
-    glass.shininess = 0.0;
-    glass.refraction = 1.0f;
-    glass.reflection = 1.0f;
-    glass.sigma = 2.0f;
-
-    Material mirror;
-    mirror.ambient = glm::vec3(0.0f);
-    mirror.diffuse = glm::vec3(0.0f);
-    mirror.specular = glm::vec3(0.0f);
-    mirror.shininess = 0.0;
-    mirror.reflection = 1.0f;
-
-    Material iceOpaque;
-    iceOpaque.texture = &snowTerrain;
-    iceOpaque.reflection = 0.02f;
-
-    Material normalmap;
-    normalmap.hasNormalMap = true;
-    normalmap.normalMap = &perlinNormal;
-    normalmap.refraction = 1.0f;
-    normalmap.reflection = 0.5f;
-    normalmap.sigma = 2.0f;
-
-    Material water;
-    water.hasNormalMap = true;
-    water.normalMap = &perlinWater;
-    water.refraction = 1.0f;
-    water.reflection = 0.5f;
-    water.sigma = 2.0f;
-    water.alpha_x = 0.7f;
-    water.alpha_y = 0.3f;
-    water.isAnisotropic = true;
-    water.shininess = 0.6f;
-
-    Material crystal;
-    crystal.sigma = 2.4f;
-    crystal.refraction = 1.0f;
-    crystal.reflection = 0.5f;
-    crystal.ambient = glm::vec3(0.1f, 0.2f, 0.3f);
-
-    objects.push_back(new MeshLoader("./meshes/bunny.obj",
-                                     glm::vec3(0, -3, 9), true, glass));
-    // plane in the front
-    objects.push_back(new Plane(glm::vec3(0.0f, 12.0f, -0.1f),
-                                glm::vec3(0.0f, 0.0f, 1.0f), true, blue_copper_specular));
-    // plane in the back
-    objects.push_back(new Plane(glm::vec3(0.0f, 12.0f, 30.0f),
-                                glm::vec3(0.0f, 0.0f, -1.0f), true, orange));
-    // plane on the left
-    objects.push_back(new Plane(glm::vec3(-15.0f, 12.0f, 14.995f),
-                                glm::vec3(1.0f, 0.0f, 0.0f), true, blue_copper_specular));
-    // plane on the right
-    objects.push_back(new Plane(glm::vec3(15.0f, 12.0f, 14.995f),
-                                glm::vec3(-1.0f, 0.0f, 0.0f), true, blue_copper_specular));
-    // plane on bottom
-    objects.push_back(new Plane(glm::vec3(0.0f, -3.0f, 14.995f),
-                                glm::vec3(0.0f, 1.0f, 0.0f), true, blue_copper_specular));
-    // plane on top
-    objects.push_back(new Plane(glm::vec3(0.0f, 27.0f, 14.995f),
-                                glm::vec3(0.0f, -1.0f, 0.0f), true, blue_copper_specular));
-
-    auto *sphere1 = new Sphere(img_texture);
-    sphere1->setTransformation(glm::translate(glm::vec3(-8, -1, 10)) * glm::scale(glm::vec3(2.0)));
-    objects.push_back(sphere1);
-
-    auto *sphere2 = new Sphere(glass);
-    sphere2->setTransformation(glm::translate(glm::vec3(-4, -2, 8.5)) * glm::scale(glm::vec3(1.0)));
-    objects.push_back(sphere2);
-
-    auto *sphere3 = new Sphere(perla);
-    sphere3->setTransformation(glm::translate(glm::vec3(0, 2.5, 16.5)) * glm::scale(glm::vec3(1.5)));
-    objects.push_back(sphere3);
-
-    auto *sphere5 = new Sphere(orange_highlight);
-    sphere5->setTransformation(glm::translate(glm::vec3(8, -1, 10)) * glm::scale(glm::vec3(2.0)));
-    objects.push_back(sphere5);
-
-    auto *sphere6 = new Sphere(orange);
-    sphere6->setTransformation(glm::translate(glm::vec3(4, -2, 8.5)) * glm::scale(glm::vec3(1.0)));
-    objects.push_back(sphere6);
-
-    auto *sphere7 = new Sphere(crystal);
-    sphere7->setTransformation(glm::translate(glm::vec3(1.5, -2.5, 5.5)) * glm::scale(glm::vec3(0.5)));
-    objects.push_back(sphere7);
-
-    auto *sphere8 = new Sphere(mirror);
-    sphere8->setTransformation(glm::translate(glm::vec3(-1.5, -2.5, 5.5)) * glm::scale(glm::vec3(0.5)));
-    objects.push_back(sphere8);
-
-    auto *sphere9 = new Sphere(iceOpaque);
-    sphere9->setTransformation(glm::translate(glm::vec3(0, -2.5, 5.5)) * glm::scale(glm::vec3(0.5)));
-    objects.push_back(sphere9);
-
-    auto *sphereBig1 = new Sphere(normalmap);
-    sphereBig1->setTransformation(glm::translate(glm::vec3(-5, 0, 14)) * glm::scale(glm::vec3(3.0)));
-    objects.push_back(sphereBig1);
-
-    auto *sphereBig2 = new Sphere(water);
-    sphereBig2->setTransformation(glm::translate(glm::vec3(5, 0, 14)) * glm::scale(glm::vec3(3.0)));
-    objects.push_back(sphereBig2);
-
-    lights.push_back(
-            new Light(glm::vec3(0, 26, 5), glm::vec3(130.0))); // top light
-    lights.push_back(
-            new Light(glm::vec3(0, 1, 10), glm::vec3(15.0))); // floor light
-    lights.push_back(new Light(glm::vec3(0, 5, 1), glm::vec3(45.0)));
-}
+    shadowCaches.resize(omp_get_max_threads());
+    for (ShadowCache &cache: shadowCaches) {
+        cache.lastOccluder.assign(lights.size(), nullptr);
+    }
+    STATS(resetRenderStats());
+    // Create an image where we will store the result, stored tile by tile so that the threads do not share cache lines.
+    // A streamed image only keeps the bands of rows that are being rendered.
+    unique_ptr<Image> image;
+    unique_ptr<TileStreamWriter> stream;
+    if (working || serving) {
+        // the tiles are sent back to the coordinator, or the server creates an image for every request
+    } else if (streaming) {
+        // enough bands for every thread to work on a different tile, and one more to absorb slow tiles
+        const int tiles_x = (imageWidth + crop.x % tile_size + tile_size - 1) / tile_size;
+        const int window = (omp_get_max_threads() + tiles_x - 1) / tiles_x + 2;
+        stream.reset(new TileStreamWriter(outputPath, imageWidth, imageHeight, tile_size, window,
+                                          crop.y % tile_size));
+        if (!stream->isOpen()) {
+            cout << "Could not write the image " << outputPath << endl;
+            return 1;
+        }
+    } else {
+        image.reset(new Image(imageWidth, imageHeight, Image::isHDRPath(outputPath), tile_size));
+    }
 
-void competitionScene() {
-
-    Material perlinNormalMap;
-    perlinNormalMap.hasNormalMap = true;
-    perlinNormalMap.normalMap = &perlinNormal;
-    perlinNormalMap.refraction = 1.0f;
-    perlinNormalMap.reflection = 0.5f;
-    perlinNormalMap.sigma = 1.333f;
-    perlinNormalMap.diffuse = glm::vec3(0.2f, 0.8f, 0.8f);
-    perlinNormalMap.ambient = glm::vec3(0.02f, 0.08f, 0.1f);
-    perlinNormalMap.texture = &perlinIceTerrain;
-
-    Material water;
-    water.hasNormalMap = true;
-    water.normalMap = &perlinWater;
-    water.refraction = 0.9f;
-    water.sigma = 1.333f;
-    water.ambient = glm::vec3(0.07f, 0.07f, 0.1f);
-    water.texture = &perlinIceTerrain;
-
-    Material eyeColor;
-    eyeColor.diffuse = glm::vec3(1.0f, 1.0f, 0.1f);
-    eyeColor.ambient = glm::vec3(1.0f, 1.0f, 0.1f);
-    eyeColor.specular = glm::vec3(0.5);
-    eyeColor.shininess = 100.0;
-
-    Material grey;
-    grey.ambient = glm::vec3(0.07f, 0.07f, 0.07f);
-    grey.diffuse = glm::vec3(0.3f, 0.3f, 0.3f);
-    grey.specular = glm::vec3(0.3);
-    grey.shininess = 10.0;
-
-    Material terrain;
-    terrain.texture = &perlinTerrain;
-
-    Material ice;
-    ice.texture = &perlinIceTerrain;
-    ice.refraction = 0.3f;
-    ice.reflection = 0.5f;
-    ice.sigma = 2.0f;
-    ice.hasNormalMap = true;
-    ice.normalMap = &perlinIceTerrain;
-    ice.ambient = glm::vec3(0.271, 0.373, 0.388);
-
-    Material iceOpaque;
-    iceOpaque.texture = &snowTerrain;
-    iceOpaque.reflection = 0.02f;
-
-    Material crystal;
-    crystal.sigma = 2.4f;
-    crystal.refraction = 1.0f;
-    crystal.reflection = 0.5f;
-    crystal.ambient = glm::vec3(0.1f, 0.2f, 0.3f);
-
-    Material qwilfish;
-    qwilfish.texture = &qwilfishTexture;
-
-    Material qwilfishMouth;
-    qwilfishMouth.ambient = glm::vec3(0.0f);
-    qwilfishMouth.diffuse = glm::vec3(0.941, 0.608, 0.647);
-    qwilfishMouth.shininess = 5.0;
-
-    Material qwilfishEyes;
-    qwilfishEyes.ambient = glm::vec3(0.0f);
-    qwilfishEyes.diffuse = glm::vec3(1, 1, 1);
-    qwilfishEyes.shininess = 5.0;
-
-    objects.push_back(new MeshLoader("./meshes/piattaforma.obj",
-                                     glm::vec3(0.3, -1.5, 0), true, iceOpaque));
-    objects.push_back(new MeshLoader("./meshes/pietre.obj",
-                                     glm::vec3(0.3, -1.5, 0), true, terrain));
-
-    objects.push_back(new MeshLoader("./meshes/kyurem_ice_uv.obj",
-                                     glm::vec3(-0.5, -0.425, 1.1), true, ice));
-    objects.push_back(new MeshLoader("./meshes/kyurem_body_uv.obj",
-                                     glm::vec3(-0.5, -0.425, 1.1), true, grey));
-
-    objects.push_back(new MeshLoader("./meshes/crystal_small_uv.obj",
-                                     glm::vec3(-0.29, -0.39, 0.81), true, crystal));
-    objects.push_back(new MeshLoader("./meshes/crystal_small_uv.obj",
-                                     glm::vec3(-0.36, -0.39, 1), true, crystal));
-    objects.push_back(new MeshLoader("./meshes/crystal_big_uv.obj",
-                                     glm::vec3(-0.34, -0.388, 0.77), true, crystal));
-    objects.push_back(new MeshLoader("./meshes/crystal_big_uv.obj",
-                                     glm::vec3(-0.65, -0.388, 1.3), true, crystal));
-    objects.push_back(new MeshLoader("./meshes/crystal_big_uv.obj",
-                                     glm::vec3(-0.59, -0.38, 1.34), true, crystal));
-
-    objects.push_back(new MeshLoader("./meshes/crystal_big_uv.obj",
-                                     glm::vec3(-0.37, -0.388, 1.27), true, crystal));
-    objects.push_back(new MeshLoader("./meshes/crystal_small_uv.obj",
-                                     glm::vec3(-0.36, -0.4, 1.32), true, crystal));
-
-    objects.push_back(new MeshLoader("./meshes/qwilfish_body.obj",
-                                     glm::vec3(-1.5, -0.65, 1.1), true, qwilfish));
-    objects.push_back(new MeshLoader("./meshes/qwilfish_eyes.obj",
-                                     glm::vec3(-1.5, -0.65, 1.1), true, qwilfishEyes));
-    objects.push_back(new MeshLoader("./meshes/qwilfish_mouth.obj",
-                                     glm::vec3(-1.5, -0.65, 1.1), true, qwilfishMouth));
-
-
-    objects.push_back(new MeshLoader("./meshes/crystalpillar.obj",
-                                     glm::vec3(-0.565, -0.225, 1.46), true, crystal));
-    objects.push_back(new MeshLoader("./meshes/crystalpillar.obj",
-                                     glm::vec3(-0.555, -0.255, 1.425), true, crystal));
-    objects.push_back(new MeshLoader("./meshes/crystalpillar.obj",
-                                     glm::vec3(-0.545, -0.235, 1.39), true, crystal));
-
-    objects.push_back(new Plane(glm::vec3(0.0f, -0.6f, 14.995f),
-                                glm::vec3(0.0f, 1.0f, 0.0f), true, perlinNormalMap));
-
-    objects.push_back(new Plane(glm::vec3(0.0f, -0.61f, 14.995f),
-                                glm::vec3(0.0f, 1.0f, 0.0f), true, water));
-
-    auto *kyuremEye = new Sphere(eyeColor);
-    kyuremEye->setTransformation(glm::translate(glm::vec3(-0.491, -0.281, 1.353)) * glm::scale(glm::vec3(0.003)));
-    objects.push_back(kyuremEye);
-
-    auto *glassSphere = new Sphere(perlinNormalMap);
-    glassSphere->setTransformation(glm::translate(glm::vec3(-0.53, -0.38, 1.42)) * glm::scale(glm::vec3(0.03)));
-    objects.push_back(glassSphere);
-
-    lights.push_back(
-            new Light(glm::vec3(11, 25, -5), glm::vec3(120.0))); // top light
-    lights.push_back(new Light(glm::vec3(-6, 9, 0), glm::vec3(100.0f)));
-    lights.push_back(new Light(glm::vec3(0, -0.1, 2.5), glm::vec3(0.5f)));
-    lights.push_back(new Light(glm::vec3(-0.7, 0.1, 1.2), glm::vec3(0.05f)));
-}
+    const Camera camera = scene.camera;
+    const Camera::View view = camera.view(width, height);
 
-int main(int argc, const char *argv[]) {
-    cout << "Running on " << omp_get_max_threads() << " threads\n";
+    // traces one ray through pixel (i, j), offset from the centre of the pixel
+    auto tracePixel = [&](int i, int j, glm::vec2 offset) {
+        return trace_ray(view.ray(i, j, offset), settings.bounces);
+    };
 
-    chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+    // FEAT: RENDER SERVER
+    if (serving) {
+        RenderServer server(serverSocket);
+        if (!server.isListening()) {
+            cout << "Could not listen on " << serverSocket << endl;
+            return 1;
+        }
+        cout << "Serving render requests on " << serverSocket << endl;
+        server.run([&](const RenderRequest &request, const string &path) {
+            const auto requestStart = chrono::steady_clock::now();
+            const string error = renderServerJob(request, path, camera, settings, width, height, tile_size,
+                                                 tileOrder);
+            cout << "Request served in "
+                 << chrono::duration<double>(chrono::steady_clock::now() - requestStart).count() << " seconds"
+                 << (error.empty() ? "" : ", error: " + error) << endl;
+            return error;
+        });
+        writeTrace();
+        return 0;
+    }
 
-    int width = /*320 1024 2048*/ 1024; // width of the image
-    int height = /*210 768 1536*/ 768; // height of the image
-    float fov = 90; // field of view
-
-    /*
-     * To switch between the scenes, make sure you uncomment the right settings for each scene.
-     * Please use the search function to look for all the places to uncomment.
-     * Sorry for the confusion!
-     */
-    //sampleScene();
-    // when using sampleScene, uncomment the sampleScene settings
-
-    competitionScene();
-    // when using competitionScene, uncomment the competitionScene settings
-
-    cout << "Scene was loaded succesfully\n";
-    Image image(width, height); // Create an image where we will store the result
-
-    const float s = 2 * tan(0.5 * fov / 180 * M_PI) / width;
-    const float X = -s * width / 2;
-    const float Y = s * height / 2;
-
-    const int tile_size = 16;
-    const int tiles_x = (width + tile_size - 1) / tile_size;
-    const int tiles_y = (height + tile_size - 1) / tile_size;
-    const int tile_count = tiles_x * tiles_y;
-
-    // sampleScene settings
-    //glm::vec3 origin(0.0);
-
-    // competitionScene settings
-    glm::vec3 origin(-0.45, -0.21, 1.52); // z smaller value -> it goes forward
-    float xTiltAngle = -0.75;
-    float yTiltAngle = 0.4;
-    glm::mat4 rotationMatrix = glm::rotate(glm::mat4(1.0f), xTiltAngle, glm::vec3(1.0f, 0.0f, 0.0f));
-    rotationMatrix = glm::rotate(rotationMatrix, yTiltAngle, glm::vec3(0.0f, 1.0f, 0.0f));
-    //
-
-    // topdown angle for competitionScene
-    /*
-     * glm::vec3 origin(-0.45, 0.5, 1.4);
-     * glm::vec3 origin(-0.4, 0, 1.5);
-     * float xTiltAngle = -1.0;
-     * float yTiltAngle = 0.4;
-     * glm::mat4 rotationMatrix = glm::rotate(glm::mat4(1.0f), xTiltAngle, glm::vec3(1.0f, 0.0f, 0.0f));
-     * rotationMatrix = glm::rotate(rotationMatrix, yTiltAngle, glm::vec3(0.0f, 1.0f, 0.0f));
-     */
-
-    // debug angle for competitionScene
-    /*
-    * glm::vec3 origin(-0.45, 0, 1.8);
-    * float xTiltAngle = -0.4;
-    * float yTiltAngle = 0.4;
-    * glm::mat4 rotationMatrix = glm::rotate(glm::mat4(1.0f), xTiltAngle, glm::vec3(1.0f, 0.0f, 0.0f));
-    * rotationMatrix = glm::rotate(rotationMatrix, yTiltAngle, glm::vec3(0.0f, 1.0f, 0.0f));
-    */
+    if (convergence) {
+        convergenceBenchmark(width, height, tracePixel);
+        return 0;
+    }
 
     //FEAT: SUPER SAMPLING ANTI ALIASING (SSAA)
-    float jitterMatrix[4 * 2] = {
-            -1.0 / 4.0, 3.0 / 4.0,
-            3.0 / 4.0, 1.0 / 3.0,
-            -3.0 / 4.0, -1.0 / 4.0,
-            1.0 / 4.0, -3.0 / 4.0,
+    const Sampler sampler(settings.pattern, settings.maxSamples);
+    settings.maxSamples = sampler.getSamplesPerPixel();
+    settings.minSamples = min(settings.minSamples, settings.maxSamples);
+    cout << "Sampling with the " << samplePatternName(settings.pattern) << " pattern, up to "
+         << settings.maxSamples << " samples per pixel\n";
+
+    // traces one sample through pixel (i, j)
+    SampleFunction traceSample = [&](int i, int j, int sample) {
+        return tracePixel(i, j, sampler.sample(i, j, sample));
     };
-#pragma omp parallel for schedule(dynamic, 1)
-    for (int tile = 0; tile < tile_count; tile++) {
-        if (omp_get_thread_num() == 0) {
-            cout << "Progress: " << ceil((float) tile / tile_count * 10000) / 100 << "%\r";
-            cout.flush();
-        }
-        const int tile_j = tile / tiles_x;                             // the tile column number
-        const int tile_i = tile - tile_j * tiles_x;                    // the tile row number
-        const int tile_i_start = tile_i * tile_size;                   // the x coordinate of the tile
-        const int tile_j_start = tile_j * tile_size;                   // the y coordinate of the tile
-        const int tile_i_end = min(tile_i_start + tile_size, width);   // the x coordinate of the tile + tile_size
-        const int tile_j_end = min(tile_j_start + tile_size, height);  // the y coordinate of the tile + tile_size
 
-        for (int i = tile_i_start; i < tile_i_end; i++)
-            for (int j = tile_j_start; j < tile_j_end; j++) {
-                glm::vec3 pixelColor(0.0f);
+    // FEAT: COST HEATMAP
+    unique_ptr<CostHeatmap> heatmap;
+    bool heatmapCounts = false; // the BVH nodes and triangles are only counted in statistics builds
+    STATS(heatmapCounts = true);
+    if (heatmapping) {
+        heatmap.reset(new CostHeatmap(crop.x, crop.y, crop.z, crop.w, heatmapCounts));
+        if (resume) {
+            cout << "The tiles read back from the checkpoint are not traced, they have no cost in the heatmap" << endl;
+        }
+        traceSample = [&, traceUnmeasured = traceSample](int i, int j, int sample) {
+            uint64_t nodes = 0, triangles = 0;
+            STATS(nodes = threadStats().bvhNodes; triangles = threadStats().triangleTests);
+            const uint64_t start = readCycleCounter();
+            const glm::vec3 color = traceUnmeasured(i, j, sample);
+            const uint64_t cycles = readCycleCounter() - start;
+            STATS(nodes = threadStats().bvhNodes - nodes; triangles = threadStats().triangleTests - triangles);
+            heatmap->add(i, j, cycles, nodes, triangles);
+            return color;
+        };
+    }
 
-                //FEAT: SUPER SAMPLING ANTI ALIASING (SSAA)
-                for (int sample = 0; sample < 4; ++sample) {
-                    float jitterX = jitterMatrix[2 * sample];
-                    float jitterY = jitterMatrix[2 * sample + 1];
+    // FEAT: TILE SCHEDULER
+    if (streaming && tileOrder != TileOrder::Rows) {
+        cout << "Streaming the image, the tiles are rendered row by row\n";
+        tileOrder = TileOrder::Rows;
+    }
+    TileScheduler scheduler(width, height, tile_size, tileOrder);
+    scheduler.setRegion(crop.x, crop.y, crop.z, crop.w);
+    scheduler.setInterleaved(streaming);
 
-                    float dx = X + (i + jitterX) * s + s / 2;
-                    float dy = Y - (j + jitterY) * s - s / 2;
-                    float dz = 1;
+    // stores a rendered tile in the image, or sends it to the streamed file
+    TileResultFunction storeTile = [&](const Tile &tile, const glm::vec3 *colors, long) {
+        storeTileInImage(*image, tile, colors, imageOrigin);
+    };
+    if (streaming) {
+        storeTile = [&](const Tile &tile, const glm::vec3 *colors, long) {
+            TraceScope trace("tone mapping");
+            const int pixelCount = (tile.x1 - tile.x0) * (tile.y1 - tile.y0);
+            vector<RGB8> pixels(pixelCount);
+            vector<RGB32F> hdrPixels(stream->isHDR() ? pixelCount : 0);
+            for (int p = 0; p < pixelCount; p++) {
+                pixels[p].set(toneMapping(colors[p]));
+                if (stream->isHDR()) {
+                    hdrPixels[p].set(colors[p]);
+                }
+            }
+            stream->writeTile(tile.x0 - imageOrigin.x, tile.y0 - imageOrigin.y, tile.x1 - imageOrigin.x,
+                              tile.y1 - imageOrigin.y, pixels.data(), hdrPixels.data());
+        };
+    }
 
-                    // sampleScene settings
-                    //glm::vec4 direction4(dx, dy, dz, 0.0f);
+    // description of the render, which a checkpoint or a distributed worker must match
+    CheckpointHeader header;
+    header.width = width;
+    header.height = height;
+    header.tileSize = tile_size;
+    header.minSamples = settings.minSamples;
+    header.maxSamples = settings.maxSamples;
+    header.pattern = (int32_t) settings.pattern;
+    header.cropX0 = crop.x;
+    header.cropY0 = crop.y;
+    header.cropX1 = crop.z;
+    header.cropY1 = crop.w;
+    header.bounces = settings.bounces;
+    header.cameraOrigin = scene.camera.origin;
+    header.cameraXTilt = scene.camera.xTiltAngle;
+    header.cameraYTilt = scene.camera.yTiltAngle;
+    header.cameraFov = scene.camera.fov;
+    header.cameraForward = scene.camera.forward;
+    header.sceneHash = sceneHash;
+
+    // FEAT: DISTRIBUTED RENDERING
+    if (working) {
+        const bool finished = runTileWorker(coordinatorAddress, header, scheduler.getTiles(),
+                                            [&](const vector<Tile> &batch, const TileResultFunction &send) {
+                                                scheduler.setTiles(batch);
+                                                renderAdaptive(send, scheduler, settings, traceSample, nullptr, false);
+                                            });
+        scheduler.printThreadStats();
+        writeTrace();
+        return finished ? 0 : 1;
+    }
 
-                    // competitionScene settings
-                    glm::vec4 direction4(dx, dy, -dz, 0.0f);
-                    direction4 = rotationMatrix * direction4;
-                    //
+    // FEAT: CHECKPOINT AND RESUME
+    unique_ptr<RenderCheckpoint> checkpoint;
+    if (checkpointing) {
+        vector<int> tilePixels(scheduler.tiles_x * scheduler.tiles_y);
+        for (const Tile &tile: scheduler.getTiles()) {
+            tilePixels[tile.index] = (tile.x1 - tile.x0) * (tile.y1 - tile.y0);
+        }
+        checkpoint.reset(new RenderCheckpoint(checkpointPath, header, tilePixels, resume,
+                                              settings.checkpointInterval));
+        if (!checkpoint->isOpen()) {
+            cout << "Could not write the checkpoint " << checkpointPath << endl;
+            return 1;
+        }
+        if (resume) {
+            cout << "Resuming " << checkpoint->getResumedTiles() << " of " << tilePixels.size()
+                 << " tiles from " << checkpointPath << endl;
+        }
+    }
 
-                    glm::vec3 direction = glm::normalize(glm::vec3(direction4));
-                    Ray ray(origin, direction);
-                    pixelColor += trace_ray(ray, 3);
+    long totalSamples; // number of samples traced over the whole image
+    if (settings.progressive) {
+        totalSamples = renderProgressive(*image, scheduler, settings, traceSample, outputPath, jobStart,
+                                         imageOrigin);
+    } else if (coordinating) {
+        // FEAT: DISTRIBUTED RENDERING
+        TileCoordinator coordinator(coordinatorPort, header, scheduler.getTiles(), tileTimeout);
+        if (!coordinator.isListening()) {
+            cout << "Could not listen on port " << coordinatorPort << endl;
+            return 1;
+        }
+        cout << "Handing out tiles on port " << coordinator.getPort() << endl;
+
+        long resumedSamples = 0;
+        if (checkpoint) {
+            for (const Tile &tile: scheduler.getTiles()) {
+                if (checkpoint->isCompleted(tile.index)) {
+                    vector<glm::vec3> colors;
+                    const long samples = checkpoint->readTile(tile.index, colors);
+                    storeTile(tile, colors.data(), samples);
+                    resumedSamples += samples;
+                    coordinator.markDone(tile.index);
                 }
+            }
+        }
 
-                pixelColor /= 4.0f;
-                image.setPixel(i, j, toneMapping(pixelColor));
+        if (localWorkers > 0) {
+            // the workers get the same render settings, without the options of the coordinator, nor the files
+            // it writes, which all the workers would otherwise write over each other
+            vector<string> workerArguments{argv[0]};
+            for (int arg = 1; arg < argc; arg++) {
+                const string option = argv[arg];
+                if (option == "--coordinator" || option == "--workers" || option == "--tile-timeout" ||
+                    option == "--checkpoint-file" || option == "--threads" || option == "--trace" ||
+                    option == "--stats-json") {
+                    arg++;
+                } else if (option != "--checkpoint" && option != "--resume" && option != "--heatmap") {
+                    workerArguments.push_back(option);
+                }
             }
+            workerArguments.push_back("--worker");
+            workerArguments.push_back("127.0.0.1:" + to_string(coordinator.getPort()));
+            coordinator.spawnLocalWorkers(localWorkers, workerArguments);
+        }
 
+        totalSamples = coordinator.run([&](const Tile &tile, const glm::vec3 *colors, long samples) {
+            if (checkpoint) {
+                checkpoint->writeTile(tile.index, colors, samples);
+            }
+            storeTile(tile, colors, samples);
+        });
+        if (totalSamples < 0) {
+            return 1;
+        }
+        totalSamples += resumedSamples;
+    } else if (benchmarking) {
+        // the same frame is rendered several times, the median is less sensitive to the noise of the machine
+        vector<double> times;
+        for (int run = 0; run < benchmarkRuns; run++) {
+            const auto runStart = chrono::steady_clock::now();
+            totalSamples = renderAdaptive(storeTile, scheduler, settings, traceSample, nullptr, false);
+            times.push_back(chrono::duration<double>(chrono::steady_clock::now() - runStart).count());
+            cout << "Run " << run + 1 << "/" << benchmarkRuns << ": " << times.back() << " seconds" << endl;
+        }
+        sort(times.begin(), times.end());
+        const size_t middle = times.size() / 2;
+        const double median = times.size() % 2 ? times[middle] : (times[middle - 1] + times[middle]) / 2;
+        cout << "Median render time: " << median << " seconds, " << totalSamples / median / 1e6
+             << " Mrays/s (camera rays)" << endl;
+    } else {
+        totalSamples = renderAdaptive(storeTile, scheduler, settings, traceSample, checkpoint.get());
     }
+
     chrono::high_resolution_clock::time_point end = chrono::high_resolution_clock::now();
     chrono::duration<double> time_span = chrono::duration_cast<chrono::duration<double>>(end - start);
     cout << "It took " << time_span.count() << " seconds to render the image." << endl;
+    cout << "Peak memory: " << peakMemoryMegabytes() << " MB" << endl;
+    cout << "Average samples per pixel: " << (double) totalSamples / ((crop.z - crop.x) * (crop.w - crop.y)) << endl;
+    if (!coordinating) {
+        scheduler.printThreadStats();
+
+        long shadowLookups = 0;
+        long shadowCacheHits = 0;
+        for (const ShadowCache &cache: shadowCaches) {
+            shadowLookups += cache.lookups;
+            shadowCacheHits += cache.hits;
+        }
+        cout << "Shadow occluder cache: " << shadowCacheHits << " hits out of " << shadowLookups << " shadow rays ("
+             << (shadowLookups > 0 ? 100.0 * shadowCacheHits / shadowLookups : 0.0) << "%)" << endl;
+
+        // FEAT: RENDER STATISTICS
+#ifdef RAYTRACER_STATS
+        printRenderStats();
+        if (!statsPath.empty() && !writeRenderStatsJSON(statsPath)) {
+            cout << "Could not write the statistics to " << statsPath << endl;
+        }
+#else
+        if (!statsPath.empty()) {
+            cout << "The statistics are only collected when building with -DRAYTRACER_STATS" << endl;
+        }
+#endif
+    }
 
-    if (argc == 2) {
-        image.writeImage(argv[1]);
+    bool written;
+    if (streaming) {
+        written = stream->close();
+        if (written) {
+            cout << "Streamed the image keeping at most " << stream->getPeakBands() << " bands of "
+                 << stream->getBandBytes() / 1024 << " kB in memory" << endl;
+        } else {
+            cout << "Could not write the streamed image " << outputPath << endl;
+        }
     } else {
-        image.writeImage("./result.ppm");
+        written = image->writeImage(outputPath);
+    }
+    if (heatmap) {
+        written = heatmap->write(outputPath, imageWidth, imageHeight, imageOrigin) && written;
+    }
+    writeTrace();
+    // the checkpoint holds every finished tile, it is only removed once the render is safely written
+    if (!written) {
+        if (checkpoint) {
+            cout << "Kept the checkpoint " << checkpointPath << ", run again with --resume to write the image"
+                 << endl;
+        }
+        return 1;
+    }
+    if (checkpoint) {
+        checkpoint->remove();
     }
 
     return 0;